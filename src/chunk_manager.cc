@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Core>
+
+#include "mesh/mesh.h"
+#include "chunk_manager.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace App {
+
+size_t TerrainChunk::bytes() const {
+	return sizeof(TerrainChunk) +
+		vertices.capacity() * sizeof(CompactTerrainVertex) +
+		indices.capacity() * sizeof(int);
+}
+
+//A chunk in range of the view point
+struct ChunkRequest {
+	float		distance;
+	Vector3i	coord;
+
+	bool operator<(ChunkRequest const& other) const {
+		return distance < other.distance;
+	}
+};
+
+ChunkManager::ChunkManager(
+	TerrainGenerator& terrain_,
+	float chunk_size_,
+	int chunk_res_,
+	float view_radius_,
+	size_t max_bytes_,
+	int num_workers) :
+	terrain(terrain_),
+	chunk_size(chunk_size_),
+	view_radius(view_radius_),
+	chunk_res(chunk_res_),
+	max_bytes(max_bytes_),
+	bytes(0),
+	stamp(0),
+	visibility(2.f * chunk_size_),
+	stopping(false) {
+
+	if(num_workers <= 0)
+		num_workers = max(1, (int)thread::hardware_concurrency());
+	for(int i=0; i<num_workers; ++i)
+		workers.push_back(thread(&ChunkManager::worker, this));
+}
+
+ChunkManager::~ChunkManager() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	work_ready.notify_all();
+	for(int i=0; i<(int)workers.size(); ++i)
+		workers[i].join();
+
+	for(int i=0; i<(int)finished.size(); ++i)
+		delete finished[i];
+	for(Cache::iterator it = cache.begin(); it != cache.end(); ++it)
+		delete it->second.chunk;
+}
+
+void ChunkManager::update(Vector3f const& view) {
+	++stamp;
+
+	vector<TerrainChunk*> done;
+	{
+		lock_guard<mutex> guard(lock);
+		done.swap(finished);
+	}
+	for(int i=0; i<(int)done.size(); ++i)
+		insert(done[i]);
+
+	//Find the chunks whose box is in range, nearest first
+	vector<ChunkRequest> in_range;
+	Vector3i lo, hi;
+	for(int i=0; i<3; ++i) {
+		lo[i] = (int)floor((view[i] - view_radius) / chunk_size);
+		hi[i] = (int)floor((view[i] + view_radius) / chunk_size);
+	}
+	for(int x=lo[0]; x<=hi[0]; ++x)
+	for(int y=lo[1]; y<=hi[1]; ++y)
+	for(int z=lo[2]; z<=hi[2]; ++z) {
+		const Vector3f box_lo = Vector3f(x, y, z) * chunk_size;
+		const Vector3f box_hi = box_lo + Vector3f(chunk_size, chunk_size, chunk_size);
+		const Vector3f nearest = view.cwiseMax(box_lo).cwiseMin(box_hi);
+		const float distance = (nearest - view).norm();
+		if(distance > view_radius)
+			continue;
+
+		ChunkRequest request;
+		request.distance = distance;
+		request.coord = Vector3i(x, y, z);
+		in_range.push_back(request);
+	}
+	stable_sort(in_range.begin(), in_range.end());
+
+	//Collect the finished chunks, and request the rest
+	visible_chunks.clear();
+	vector<Vector3i> missing;
+	for(int i=0; i<(int)in_range.size(); ++i) {
+		Cache::iterator it = cache.find(in_range[i].coord);
+		if(it == cache.end()) {
+			missing.push_back(in_range[i].coord);
+			continue;
+		}
+		touch(it->second);
+		if(it->second.chunk->indices.size() > 0)
+			visible_chunks.push_back(it->second.chunk);
+	}
+
+	{
+		lock_guard<mutex> guard(lock);
+		queue.clear();
+		for(int i=(int)missing.size()-1; i>=0; --i) {
+			if(running.count(missing[i]) == 0)
+				queue.push_back(missing[i]);
+		}
+	}
+	work_ready.notify_all();
+
+	evict();
+}
+
+void ChunkManager::wait() {
+	unique_lock<mutex> guard(lock);
+	while(!queue.empty() || !running.empty())
+		work_done.wait(guard);
+}
+
+int ChunkManager::pending() {
+	lock_guard<mutex> guard(lock);
+	return (int)(queue.size() + running.size());
+}
+
+void ChunkManager::worker() {
+	while(true) {
+		Vector3i coord;
+		{
+			unique_lock<mutex> guard(lock);
+			while(!stopping && queue.empty())
+				work_ready.wait(guard);
+			if(stopping)
+				return;
+			coord = queue.back();
+			queue.pop_back();
+			running.insert(coord);
+		}
+
+		TerrainChunk* chunk = generate(coord);
+
+		{
+			lock_guard<mutex> guard(lock);
+			running.erase(coord);
+			finished.push_back(chunk);
+		}
+		work_done.notify_all();
+	}
+}
+
+TerrainChunk* ChunkManager::generate(Vector3i const& coord) {
+	const Vector3f lo = coord.cast<float>() * chunk_size;
+	const Vector3f hi = lo + Vector3f(chunk_size, chunk_size, chunk_size);
+
+	TerrainChunk* chunk = new TerrainChunk();
+	chunk->coord = coord;
+	chunk->origin = lo - Vector3f(chunk_size, chunk_size, chunk_size) * .5f;
+	chunk->extent = 2.f * chunk_size;
+	chunk->lo = lo;
+	chunk->hi = lo;
+	//isocontour pads the grid by a cell, and the chunk owns the faces of the
+	//edges which start in the padding
+	const float h = chunk_size / chunk_res;
+	const Vector3f pad(h, h, h);
+	if(!Mesh::impl::may_cross(terrain, (lo - pad).eval(), (hi + pad).eval()))
+		return chunk;
+
+	Mesh::TriMesh<TerrainVertex> mesh;
+	TerrainAttribute attr(terrain);
+	Mesh::isocontour(mesh, terrain, attr, lo, hi, Vector3i(chunk_res, chunk_res, chunk_res));
+	if(mesh.triangles().empty())
+		return chunk;
+
+	const TerrainVertex* vbuffer;
+	const int* ibuffer;
+	int vcount, icount;
+	mesh.get_buffers(&vbuffer, &vcount, &ibuffer, &icount);
+	chunk->vertices.resize(vcount);
+	for(int i=0; i<vcount; ++i) {
+		chunk->vertices[i] = compact_vertex(vbuffer[i], chunk->origin, chunk->extent);
+		if(i == 0)
+			chunk->lo = chunk->hi = vbuffer[i].position;
+		chunk->lo = chunk->lo.cwiseMin(vbuffer[i].position);
+		chunk->hi = chunk->hi.cwiseMax(vbuffer[i].position);
+	}
+	chunk->indices.assign(ibuffer, ibuffer + icount);
+	return chunk;
+}
+
+void ChunkManager::insert(TerrainChunk* chunk) {
+	//A chunk finishing between the two locks of update is requested again
+	Cache::iterator it = cache.find(chunk->coord);
+	if(it != cache.end()) {
+		delete chunk;
+		return;
+	}
+
+	CacheEntry entry;
+	entry.chunk = chunk;
+	entry.lru = lru.insert(lru.begin(), chunk->coord);
+	entry.stamp = 0;
+	cache[chunk->coord] = entry;
+	bytes += chunk->bytes();
+	if(chunk->indices.size() > 0)
+		visibility.insert(chunk);
+}
+
+void ChunkManager::touch(CacheEntry& entry) {
+	lru.splice(lru.begin(), lru, entry.lru);
+	entry.stamp = stamp;
+}
+
+void ChunkManager::evict() {
+	//Chunks in range at this update are never evicted
+	while(bytes > max_bytes && !lru.empty()) {
+		Cache::iterator it = cache.find(lru.back());
+		if(it->second.stamp == stamp)
+			break;
+
+		bytes -= it->second.chunk->bytes();
+		visibility.remove(it->first);
+		delete it->second.chunk;
+		lru.pop_back();
+		cache.erase(it);
+	}
+}
+
+};
@@ -0,0 +1,165 @@
+#ifndef CHUNK_MANAGER_H
+#define CHUNK_MANAGER_H
+
+#include <stddef.h>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "terrain.h"
+#include "visibility.h"
+
+//Default memory budget for the meshes kept by a ChunkManager
+#define CHUNK_CACHE_BYTES	(256 << 20)
+
+namespace App {
+
+///Contoured mesh of one chunk, as buffers ready to be drawn
+struct TerrainChunk {
+	Eigen::Vector3i						coord;
+
+	//Box the vertex positions are quantized to (see CompactTerrainVertex).  It
+	//is twice the size of the chunk and centered on it, which holds the
+	//padding cells of isocontour and keeps the quantization steps of adjacent
+	//chunks in line, so that their seams match.
+	Eigen::Vector3f						origin;
+	float								extent;
+
+	//Bounding box of the vertices
+	Eigen::Vector3f						lo, hi;
+
+	std::vector<CompactTerrainVertex>	vertices;
+	std::vector<int>					indices;
+
+	TerrainVertex vertex(int v) const {
+		return expand_vertex(vertices[v], origin, extent);
+	}
+
+	///Memory held by the chunk
+	size_t bytes() const;
+};
+
+/**
+ * Streams the terrain around a moving view point.
+ *
+ * The world is divided into cubes of chunk_size, each contoured with
+ * chunk_res cells along each axis.  update requests the chunks within
+ * view_radius of the view point, nearest first, and a pool of num_workers
+ * threads (one per core if 0) contours them in the background.  Requests
+ * which fall out of range before a worker reaches them are dropped.  Chunks
+ * which the terrain bounds rule out are not contoured (see
+ * mesh/algorithms/density.h).
+ *
+ * Finished meshes are kept in a least recently used cache.  Once they take
+ * more than max_bytes, the chunks which have been out of range the longest
+ * are evicted, so memory and startup time depend on the view radius rather
+ * than the size of the world.  max_bytes should hold at least the chunks in
+ * range.
+ *
+ * Adjacent chunks are contoured on the same lattice, so their meshes meet
+ * along the seams, where the vertices are duplicated.  update, visible and
+ * wait are to be called from one thread.  terrain must outlive the manager,
+ * and is shared by the workers.
+ */
+struct ChunkManager {
+	ChunkManager(
+		TerrainGenerator& terrain,
+		float chunk_size = 32.f,
+		int chunk_res = 32,
+		float view_radius = 128.f,
+		size_t max_bytes = CHUNK_CACHE_BYTES,
+		int num_workers = 0);
+	~ChunkManager();
+
+	/**
+	 * Moves the view point to view.  Collects the chunks finished since the
+	 * last call, requests the missing ones in range and evicts old chunks.
+	 */
+	void update(Eigen::Vector3f const& view);
+
+	///Finished chunks in range at the last update, nearest first, which stay valid until the next update
+	std::vector<TerrainChunk const*> const& visible() const {
+		return visible_chunks;
+	}
+
+	/**
+	 * Writes the finished chunks within the view radius of eye which
+	 * intersect frustum to out, nearest first, with their level of detail
+	 * (see ChunkVisibility).  They stay valid until the next update.
+	 */
+	void cull(
+		Frustum const& frustum,
+		Eigen::Vector3f const& eye,
+		std::vector<VisibleChunk>& out) const {
+		visibility.select(frustum, eye, view_radius, out);
+	}
+
+	///Blocks until every chunk requested by the last update is finished
+	void wait();
+
+	///Number of requested chunks which are not finished
+	int pending();
+
+	size_t cached_bytes() const {
+		return bytes;
+	}
+
+	int cached_chunks() const {
+		return (int)cache.size();
+	}
+
+private:
+	ChunkManager(ChunkManager const&);
+	ChunkManager& operator=(ChunkManager const&);
+
+	typedef std::list<Eigen::Vector3i>	LRUList;
+
+	struct CacheEntry {
+		TerrainChunk*		chunk;
+		LRUList::iterator	lru;
+		int					stamp;
+	};
+
+	typedef std::map<Eigen::Vector3i, CacheEntry, ChunkCoordLess>	Cache;
+
+	void worker();
+	TerrainChunk* generate(Eigen::Vector3i const& coord);
+
+	void insert(TerrainChunk* chunk);
+	void touch(CacheEntry& entry);
+	void evict();
+
+	TerrainGenerator&	terrain;
+	float				chunk_size, view_radius;
+	int					chunk_res;
+	size_t				max_bytes;
+
+	//Owned by the thread calling update
+	Cache								cache;
+	LRUList								lru;
+	size_t								bytes;
+	int									stamp;
+	std::vector<TerrainChunk const*>	visible_chunks;
+	ChunkVisibility						visibility;
+
+	//Shared with the workers, guarded by lock.  queue is sorted with the
+	//nearest chunk last.
+	std::mutex									lock;
+	std::condition_variable						work_ready, work_done;
+	std::vector<Eigen::Vector3i>				queue;
+	std::set<Eigen::Vector3i, ChunkCoordLess>	running;
+	std::vector<TerrainChunk*>					finished;
+	bool										stopping;
+
+	std::vector<std::thread>	workers;
+};
+
+};
+
+#endif
@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <Eigen/Core>
+#include "density_graph.h"
+#include "noise.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace App {
+
+bool DensityNode::operator<(DensityNode const& other) const {
+	if(op != other.op)
+		return op < other.op;
+	for(int i=0; i<3; ++i) {
+		if(args[i] != other.args[i])
+			return args[i] < other.args[i];
+	}
+	for(int i=0; i<2; ++i) {
+		if(value[i] != other.value[i])
+			return value[i] < other.value[i];
+	}
+	return octaves < other.octaves;
+}
+
+//Value of an operation on scalars, used for constant folding
+static float apply(DensityOp op, float a, float b, const float value[2]) {
+	switch(op) {
+		case DENSITY_ADD:	return a + b;
+		case DENSITY_SUB:	return a - b;
+		case DENSITY_MUL:	return a * b;
+		case DENSITY_MIN:	return std::min(a, b);
+		case DENSITY_MAX:	return std::max(a, b);
+		case DENSITY_NEG:	return -a;
+		case DENSITY_ABS:	return std::abs(a);
+		case DENSITY_CLAMP:	return std::min(std::max(a, value[0]), value[1]);
+		default:			return value[0];
+	}
+}
+
+DensityGraph::DensityGraph() {
+	add_node(DENSITY_X, 0);
+	add_node(DENSITY_Y, 0);
+	add_node(DENSITY_Z, 0);
+}
+
+int DensityGraph::add_node(DensityOp op, int a, int b, int c, float v0, float v1, int octaves) {
+	//Put the arguments of commutative operations in a canonical order
+	if((op == DENSITY_ADD || op == DENSITY_MUL || op == DENSITY_MIN || op == DENSITY_MAX) && b < a)
+		std::swap(a, b);
+
+	DensityNode node;
+	node.op = op;
+	node.args[0] = a;
+	node.args[1] = b;
+	node.args[2] = c;
+	node.value[0] = v0;
+	node.value[1] = v1;
+	node.octaves = octaves;
+
+	//Fold operations on constants.  Noise is left to the program, since its
+	//value depends on the context the program is compiled with.
+	if(op > DENSITY_CONSTANT && op != DENSITY_NOISE) {
+		const int arity = op >= DENSITY_NEG ? 1 : 2;
+		bool folded = true;
+		float v[2] = { 0.f, 0.f };
+		for(int i=0; i<arity; ++i) {
+			if(nodes[node.args[i]].op != DENSITY_CONSTANT) {
+				folded = false;
+				break;
+			}
+			v[i] = nodes[node.args[i]].value[0];
+		}
+		if(folded)
+			return constant(apply(op, v[0], v[1], node.value));
+	}
+
+	//Merge with an identical node
+	map<DensityNode, int>::iterator it = index.find(node);
+	if(it != index.end())
+		return it->second;
+
+	const int name = (int)nodes.size();
+	nodes.push_back(node);
+	index[node] = name;
+	return name;
+}
+
+int DensityGraph::constant(float v) {
+	return add_node(DENSITY_CONSTANT, 0, 0, 0, v);
+}
+
+int DensityGraph::add(int a, int b) {
+	return add_node(DENSITY_ADD, a, b);
+}
+
+int DensityGraph::sub(int a, int b) {
+	return add_node(DENSITY_SUB, a, b);
+}
+
+int DensityGraph::mul(int a, int b) {
+	return add_node(DENSITY_MUL, a, b);
+}
+
+int DensityGraph::min(int a, int b) {
+	return add_node(DENSITY_MIN, a, b);
+}
+
+int DensityGraph::max(int a, int b) {
+	return add_node(DENSITY_MAX, a, b);
+}
+
+int DensityGraph::neg(int a) {
+	return add_node(DENSITY_NEG, a);
+}
+
+int DensityGraph::abs(int a) {
+	return add_node(DENSITY_ABS, a);
+}
+
+int DensityGraph::clamp(int a, float lo, float hi) {
+	return add_node(DENSITY_CLAMP, a, 0, 0, lo, hi);
+}
+
+int DensityGraph::noise(DensityCoords const& p, int octaves) {
+	return add_node(DENSITY_NOISE, p.x, p.y, p.z, 0.f, 0.f, octaves);
+}
+
+DensityCoords DensityGraph::coords() const {
+	DensityCoords result = { x(), y(), z() };
+	return result;
+}
+
+DensityCoords DensityGraph::translate(DensityCoords const& p, Vector3f const& offset) {
+	DensityCoords result = {
+		add(p.x, constant(offset[0])),
+		add(p.y, constant(offset[1])),
+		add(p.z, constant(offset[2])) };
+	return result;
+}
+
+DensityCoords DensityGraph::scale(DensityCoords const& p, Vector3f const& factor) {
+	DensityCoords result = {
+		mul(p.x, constant(factor[0])),
+		mul(p.y, constant(factor[1])),
+		mul(p.z, constant(factor[2])) };
+	return result;
+}
+
+DensityCoords DensityGraph::warp(DensityCoords const& p, int dx, int dy, int dz) {
+	DensityCoords result = {
+		add(p.x, dx),
+		add(p.y, dy),
+		add(p.z, dz) };
+	return result;
+}
+
+DensityProgram::DensityProgram(DensityGraph const& graph, int root, NoiseContext const* noise_) :
+	noise(noise_) {
+	vector<DensityNode> const& nodes = graph.nodes;
+	const int n = root + 1;
+
+	//Find the nodes root depends on, and the last instruction using each
+	vector<bool> live(n, false);
+	vector<int> last_use(n, -1);
+	live[root] = true;
+	last_use[root] = n;
+	for(int i=root; i>=0; --i) {
+		if(!live[i] || nodes[i].op <= DENSITY_CONSTANT)
+			continue;
+		for(int j=0; j<3; ++j) {
+			const int a = nodes[i].args[j];
+			live[a] = true;
+			last_use[a] = std::max(last_use[a], i);
+		}
+	}
+
+	//Assign registers, reusing those of dead values
+	vector<int> reg_of(n, -1);
+	vector<int> free_regs;
+	vector< pair<int, float> > constants;
+	register_count = 3;
+	for(int i=0; i<n; ++i) {
+		if(!live[i])
+			continue;
+		DensityNode const& node = nodes[i];
+
+		if(node.op <= DENSITY_Z) {
+			reg_of[i] = node.op - DENSITY_X;
+			continue;
+		}
+		if(node.op == DENSITY_CONSTANT) {
+			reg_of[i] = register_count++;
+			constants.push_back(make_pair(reg_of[i], node.value[0]));
+			continue;
+		}
+
+		DensityInstruction inst;
+		inst.op = node.op;
+		for(int j=0; j<3; ++j)
+			inst.args[j] = reg_of[node.args[j]];
+		inst.value[0] = node.value[0];
+		inst.value[1] = node.value[1];
+		inst.octaves = node.octaves;
+
+		//Arguments used for the last time here may be overwritten, since every
+		//instruction reads lane k of its arguments before writing lane k
+		for(int j=0; j<3; ++j) {
+			const int a = node.args[j];
+			const DensityOp a_op = nodes[a].op;
+			if(	last_use[a] == i && a_op > DENSITY_CONSTANT &&
+				find(free_regs.begin(), free_regs.end(), reg_of[a]) == free_regs.end())
+				free_regs.push_back(reg_of[a]);
+		}
+
+		if(free_regs.size() > 0) {
+			inst.dst = free_regs.back();
+			free_regs.pop_back();
+		}
+		else {
+			inst.dst = register_count++;
+		}
+		reg_of[i] = inst.dst;
+		instructions.push_back(inst);
+	}
+	result = reg_of[root];
+
+	//Load constants
+	registers.resize(register_count * DENSITY_BATCH_SIZE, 0.f);
+	intervals.resize(register_count, Vector2f(0, 0));
+	for(int i=0; i<(int)constants.size(); ++i) {
+		const int r = constants[i].first;
+		const float v = constants[i].second;
+		fill(reg(r), reg(r) + DENSITY_BATCH_SIZE, v);
+		intervals[r] = Vector2f(v, v);
+	}
+}
+
+void DensityProgram::run(int count) {
+	for(int i=0; i<(int)instructions.size(); ++i) {
+		DensityInstruction const& inst = instructions[i];
+		float* d = reg(inst.dst);
+		float const* a = reg(inst.args[0]);
+		float const* b = reg(inst.args[1]);
+		float const* c = reg(inst.args[2]);
+
+		switch(inst.op) {
+			case DENSITY_ADD:
+				for(int k=0; k<count; ++k)
+					d[k] = a[k] + b[k];
+			break;
+			case DENSITY_SUB:
+				for(int k=0; k<count; ++k)
+					d[k] = a[k] - b[k];
+			break;
+			case DENSITY_MUL:
+				for(int k=0; k<count; ++k)
+					d[k] = a[k] * b[k];
+			break;
+			case DENSITY_MIN:
+				for(int k=0; k<count; ++k)
+					d[k] = std::min(a[k], b[k]);
+			break;
+			case DENSITY_MAX:
+				for(int k=0; k<count; ++k)
+					d[k] = std::max(a[k], b[k]);
+			break;
+			case DENSITY_NEG:
+				for(int k=0; k<count; ++k)
+					d[k] = -a[k];
+			break;
+			case DENSITY_ABS:
+				for(int k=0; k<count; ++k)
+					d[k] = std::abs(a[k]);
+			break;
+			case DENSITY_CLAMP:
+				for(int k=0; k<count; ++k)
+					d[k] = std::min(std::max(a[k], inst.value[0]), inst.value[1]);
+			break;
+			case DENSITY_NOISE:
+				simplexNoise3D_batch(noise, a, b, c, d, count, inst.octaves);
+			break;
+			default:
+			break;
+		}
+	}
+}
+
+float DensityProgram::operator()(Vector3f const& p) {
+	for(int i=0; i<3; ++i)
+		reg(i)[0] = p[i];
+	run(1);
+	return reg(result)[0];
+}
+
+void DensityProgram::operator()(
+	Vector3f const& origin,
+	Vector3f const& step,
+	int count,
+	float* out) {
+
+	for(int start=0; start<count; start+=DENSITY_BATCH_SIZE) {
+		const int n = std::min(count - start, DENSITY_BATCH_SIZE);
+		for(int i=0; i<3; ++i) {
+			float* r = reg(i);
+			for(int k=0; k<n; ++k)
+				r[k] = origin[i] + (float)(start + k) * step[i];
+		}
+		run(n);
+		memcpy(out + start, reg(result), n * sizeof(float));
+	}
+}
+
+void DensityProgram::evaluate(
+	float const* x,
+	float const* y,
+	float const* z,
+	int count,
+	float* out) {
+
+	for(int start=0; start<count; start+=DENSITY_BATCH_SIZE) {
+		const int n = std::min(count - start, DENSITY_BATCH_SIZE);
+		memcpy(reg(0), x + start, n * sizeof(float));
+		memcpy(reg(1), y + start, n * sizeof(float));
+		memcpy(reg(2), z + start, n * sizeof(float));
+		run(n);
+		memcpy(out + start, reg(result), n * sizeof(float));
+	}
+}
+
+Vector2f DensityProgram::bounds(Vector3f const& lo, Vector3f const& hi) {
+	for(int i=0; i<3; ++i)
+		intervals[i] = Vector2f(lo[i], hi[i]);
+
+	for(int i=0; i<(int)instructions.size(); ++i) {
+		DensityInstruction const& inst = instructions[i];
+		const Vector2f a = intervals[inst.args[0]];
+		const Vector2f b = intervals[inst.args[1]];
+		Vector2f& d = intervals[inst.dst];
+
+		switch(inst.op) {
+			case DENSITY_ADD:
+				d = Vector2f(a[0] + b[0], a[1] + b[1]);
+			break;
+			case DENSITY_SUB:
+				d = Vector2f(a[0] - b[1], a[1] - b[0]);
+			break;
+			case DENSITY_MUL: {
+				const float p[4] = { a[0] * b[0], a[0] * b[1], a[1] * b[0], a[1] * b[1] };
+				d = Vector2f(*min_element(p, p+4), *max_element(p, p+4));
+			}
+			break;
+			case DENSITY_MIN:
+				d = Vector2f(std::min(a[0], b[0]), std::min(a[1], b[1]));
+			break;
+			case DENSITY_MAX:
+				d = Vector2f(std::max(a[0], b[0]), std::max(a[1], b[1]));
+			break;
+			case DENSITY_NEG:
+				d = Vector2f(-a[1], -a[0]);
+			break;
+			case DENSITY_ABS:
+				if(a[0] >= 0)
+					d = a;
+				else if(a[1] <= 0)
+					d = Vector2f(-a[1], -a[0]);
+				else
+					d = Vector2f(0, std::max(-a[0], a[1]));
+			break;
+			case DENSITY_CLAMP:
+				d = Vector2f(
+					std::min(std::max(a[0], inst.value[0]), inst.value[1]),
+					std::min(std::max(a[1], inst.value[0]), inst.value[1]));
+			break;
+			case DENSITY_NOISE: {
+				const Vector2f c = intervals[inst.args[2]];
+				simplexNoise3D_bounds(noise, a[0], b[0], c[0], a[1], b[1], c[1], inst.octaves, &d[0], &d[1]);
+			}
+			break;
+			default:
+			break;
+		}
+	}
+
+	return intervals[result];
+}
+
+};
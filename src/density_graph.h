@@ -0,0 +1,169 @@
+#ifndef DENSITY_GRAPH_H
+#define DENSITY_GRAPH_H
+
+#include <map>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "noise.h"
+
+//Number of points a DensityProgram evaluates per pass over its instructions
+#define DENSITY_BATCH_SIZE	64
+
+namespace App {
+
+///Operations of density expression nodes
+enum DensityOp {
+	DENSITY_X,
+	DENSITY_Y,
+	DENSITY_Z,
+	DENSITY_CONSTANT,
+	DENSITY_ADD,
+	DENSITY_SUB,
+	DENSITY_MUL,
+	DENSITY_MIN,
+	DENSITY_MAX,
+	DENSITY_NEG,
+	DENSITY_ABS,
+	DENSITY_CLAMP,
+	DENSITY_NOISE
+};
+
+/**
+ * A node of a density expression.  args name earlier nodes of the graph,
+ * value holds the constant of DENSITY_CONSTANT and the range of
+ * DENSITY_CLAMP, and octaves is used by DENSITY_NOISE.  Unused fields are 0.
+ */
+struct DensityNode {
+	DensityOp	op;
+	int			args[3];
+	float		value[2];
+	int			octaves;
+
+	bool operator<(DensityNode const& other) const;
+};
+
+///The three coordinate expressions of a (possibly transformed) domain
+struct DensityCoords {
+	int x, y, z;
+};
+
+/**
+ * Builds a density as a graph of expression nodes, which are named by their
+ * index in nodes.  Nodes 0, 1 and 2 are the x, y and z coordinates.
+ *
+ * Identical nodes are merged as they are added (add and mul, min and max are
+ * treated as commutative), and nodes whose arguments are all constant are
+ * folded, so a subexpression which is built twice is evaluated once by the
+ * compiled program.  Domain transforms are expressed by building the
+ * coordinates passed to noise, eg.
+ *
+ *	DensityGraph g;
+ *	DensityCoords p = g.scale(g.coords(), Vector3f(0.01, 0.01, 0.01));
+ *	int terrain = g.add(g.sub(g.y(), g.constant(128)), g.mul(g.constant(90), g.noise(p, 3)));
+ */
+struct DensityGraph {
+	DensityGraph();
+
+	int x() const { return 0; }
+	int y() const { return 1; }
+	int z() const { return 2; }
+	int constant(float v);
+
+	int add(int a, int b);
+	int sub(int a, int b);
+	int mul(int a, int b);
+	int min(int a, int b);
+	int max(int a, int b);
+	int neg(int a);
+	int abs(int a);
+	int clamp(int a, float lo, float hi);
+
+	///simplexNoise3D of the coordinates p
+	int noise(DensityCoords const& p, int octaves);
+
+	DensityCoords coords() const;
+	DensityCoords translate(DensityCoords const& p, Eigen::Vector3f const& offset);
+	DensityCoords scale(DensityCoords const& p, Eigen::Vector3f const& factor);
+
+	///Displaces p by the expressions dx, dy and dz
+	DensityCoords warp(DensityCoords const& p, int dx, int dy, int dz);
+
+	std::vector<DensityNode>	nodes;
+
+private:
+	int add_node(DensityOp op, int a, int b = 0, int c = 0, float v0 = 0.f, float v1 = 0.f, int octaves = 0);
+
+	std::map<DensityNode, int>	index;
+};
+
+///Instruction of a DensityProgram, which reads registers args and writes dst
+struct DensityInstruction {
+	DensityOp	op;
+	int			dst, args[3];
+	float		value[2];
+	int			octaves;
+};
+
+/**
+ * A density expression compiled from a DensityGraph to a flat list of
+ * instructions over registers of DENSITY_BATCH_SIZE floats.
+ *
+ * Only the nodes the root depends on are compiled.  Registers 0, 1 and 2
+ * hold the coordinates, constants are loaded into registers of their own
+ * once, and every other register is reused as soon as the value it holds is
+ * dead, so the working set of a batch stays small.  Each instruction is a
+ * tight loop over the batch, which the compiler vectorizes, and noise uses
+ * simplexNoise3D_batch.
+ *
+ * Implements the point and batched row forms of a density, as well as a
+ * bound over boxes, computed by evaluating the instructions with interval
+ * arithmetic (see mesh/algorithms/density.h).  The registers are part of the
+ * program, so threads evaluating the same density need a copy each.  Noise
+ * is evaluated with the given context, which must outlive the program.
+ */
+struct DensityProgram {
+	DensityProgram(
+		DensityGraph const& graph,
+		int root,
+		NoiseContext const* noise = defaultNoiseContext());
+
+	float operator()(Eigen::Vector3f const& p);
+
+	//Batched row evaluator, see mesh/algorithms/density.h
+	void operator()(
+		Eigen::Vector3f const& origin,
+		Eigen::Vector3f const& step,
+		int count,
+		float* out);
+
+	///Evaluates the density at the count points (x[i], y[i], z[i])
+	void evaluate(
+		float const* x,
+		float const* y,
+		float const* z,
+		int count,
+		float* out);
+
+	///Range [min,max] containing the density on the closed box [lo,hi]
+	Eigen::Vector2f bounds(Eigen::Vector3f const& lo, Eigen::Vector3f const& hi);
+
+	std::vector<DensityInstruction>	instructions;
+	int								register_count, result;
+
+private:
+	void run(int count);
+
+	float* reg(int r) {
+		return &registers[r * DENSITY_BATCH_SIZE];
+	}
+
+	NoiseContext const*				noise;
+	std::vector<float>				registers;
+	std::vector<Eigen::Vector2f>	intervals;
+};
+
+};
+
+#endif
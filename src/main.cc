@@ -11,6 +11,7 @@
 #include "mesh/implementation/convex_cell.h"
 
 #include "terrain.h"
+#include "chunk_manager.h"
 
 using namespace std;
 using namespace Eigen;
@@ -20,67 +21,24 @@ namespace App {
 
 bool running = true;
 
-GLuint scene_display_list = 0;
 double vw=1., vx=0., vy=0., vz=0.;
 double tx = 0., ty=0., tz=100.;
 double fov=45., znear=1., zfar=1000.;
 int mx = 0, my = 0, mz = 0;
 
+//Terrain is streamed around view_center, which the camera orbits
+TerrainGenerator terrain_func;
+ChunkManager* chunks = NULL;
+Vector3f view_center(128, 96, 128);
+
 Mesh::impl::ConvexCell2D test_cell;
 
 typedef Mesh::impl::ConvexCell2D::halfspace halfspace;
 typedef Mesh::impl::ConvexCell2D::normal	normal;
 
 void init() {
-
-	/*
-    scene_display_list = glGenLists(1);
-    glNewList(scene_display_list, GL_COMPILE);
-    
-	TriMesh<TerrainVertex> base_mesh;
-	TerrainGenerator terrain_func;
-	TerrainAttribute terrain_attr(terrain_func);
-	
-	printf("Contouring...\n");
-	
-	Mesh::isocontour(
-		base_mesh,
-		terrain_func,
-		terrain_attr,
-		Vector3f(0, 0, 0),
-		Vector3f( 256, 128, 256),
-		Vector3i(256, 128, 256) );
-	
-	printf("Done!\n");
-	
-	const TerrainVertex *vbuffer;
-	const int *ibuffer;
-	int vcount, icount;
-
-	base_mesh.get_buffers(
-		&vbuffer,
-		&vcount,
-		&ibuffer,
-		&icount);
-
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-	glBegin(GL_TRIANGLES);
-	for(int i=0; i<icount; ++i) {
-		auto v = vbuffer[ibuffer[i]];
-		glColor3f(v.color[0], v.color[1], v.color[2]);
-		glNormal3f(v.normal[0], v.normal[1], v.normal[2]);
-		glVertex3f(v.position[0], v.position[1], v.position[2]);
-	}
-	glEnd();
-	
-    glEndList();
-    */
-    
-    
-
-    
-    
+	printf("Streaming terrain...\n");
+	chunks = new ChunkManager(terrain_func);
 }
 
 void input() {
@@ -192,7 +150,37 @@ void draw() {
         }
     }
     
-    //glCallList(scene_display_list);
+    chunks->update(view_center);
+    
+    glPushMatrix();
+    glTranslatef(-view_center[0], -view_center[1], -view_center[2]);
+    
+    //Only submit the chunks in the view frustum
+    Matrix4f projection, modelview;
+    glGetFloatv(GL_PROJECTION_MATRIX, projection.data());
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview.data());
+    const Matrix3f rotation = modelview.block<3,3>(0,0);
+    const Vector3f eye = -(rotation.transpose() * modelview.block<3,1>(0,3));
+    static vector<VisibleChunk> visible;
+    chunks->cull(Frustum(projection * modelview), eye, visible);
+    
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glBegin(GL_TRIANGLES);
+    for(int c=0; c<(int)visible.size(); ++c) {
+    	const TerrainChunk* chunk = visible[c].chunk;
+    	for(int i=0; i<(int)chunk->indices.size(); ++i) {
+    		auto v = chunk->vertex(chunk->indices[i]);
+    		glColor3f(v.color[0], v.color[1], v.color[2]);
+    		glNormal3f(v.normal[0], v.normal[1], v.normal[2]);
+    		glVertex3f(v.position[0], v.position[1], v.position[2]);
+    	}
+    }
+    glEnd();
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+    glPopMatrix();
+    
     auto vertices = test_cell.vertices();
     
     glColor3f(1,1,1);
@@ -219,6 +207,7 @@ int main(int argc, char* argv[]) {
         App::draw();
         glfwSwapBuffers();
     }
+    delete App::chunks;
 
     glfwTerminate();
     return 0;
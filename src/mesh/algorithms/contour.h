@@ -2,29 +2,491 @@
 #define MESH_CONTOUR_H
 
 #include <cassert>
+#include <cfloat>
 #include <cmath>
 #include <unordered_map>
 #include <algorithm>
 #include <utility>
+#include <vector>
 
 #include <Eigen/Core>
 #include <Eigen/Dense>
 
 #include "mesh/implementation/util.h"
 #include "mesh/core/trimesh.h"
+#include "mesh/algorithms/density.h"
+
+//Edge length in cells of the blocks isocontour tests against density bounds
+#define CONTOUR_BOUNDS_BLOCK	16
 
 namespace Mesh {
 
+namespace impl {
+
+	/**
+	 * Tests the edge from p (value c_f) along axis e to its neighbor (value
+	 * e_f) for a crossing of the 0-level set.  On a crossing, stores the
+	 * intercept in the first 3 components of result and the slope of f along
+	 * the edge in the last.  The slope is never 0, and its sign gives the
+	 * orientation of the surface.
+	 */
+	inline bool edge_crossing(
+		int e,
+		Eigen::Vector3f const& p,
+		float h_e,
+		float c_f,
+		float e_f,
+		Eigen::Vector4f& result) {
+
+		//Do edge intersection test
+		if(c_f < -FP_TOLERANCE) {
+			if(e_f < -FP_TOLERANCE) {
+				return false;
+			}
+		}
+		else if(c_f > FP_TOLERANCE) {
+			if(e_f > FP_TOLERANCE) {
+				return false;
+			}
+		}
+		else {
+			if(std::abs(e_f) < FP_TOLERANCE) {
+				return false;
+			}
+		}
+
+		//Find intercept
+		Eigen::Vector3f e_p(p);
+		e_p[e] += h_e;
+		const float t = c_f / (c_f - e_f);
+		const Eigen::Vector3f intercept = (1.-t)*p + t*e_p;
+		float slope = (e_f - c_f) / h_e;
+		if(slope == 0)
+			slope = -FLT_MIN;
+		result = Eigen::Vector4f(
+			intercept[0], intercept[1], intercept[2], slope);
+		return true;
+	}
+
+	/**
+	 * Sparse edge crossings and cell vertices for the dual contouring grid.
+	 *
+	 * Edges are named by their lower grid point and an axis e, cells by their
+	 * lower grid point.  Crossings may be added in any order, which lets the
+	 * dense and adaptive sweeps share the vertex placement and face generation.
+	 */
+	struct ContourCells {
+
+		//Edge intersections
+		typename SpatialGrid<Eigen::Vector4f>::type edges[3];
+
+		//Mesh vertices
+		typename SpatialGrid<int>::type vertices;
+
+		/**
+		 * Tests the edge from grid point coord (at position p, value c_f) along
+		 * axis e against its neighbor (value e_f), and records the crossing.
+		 */
+		void add_edge(
+			Eigen::Vector3i const& coord,
+			int e,
+			Eigen::Vector3f const& p,
+			float h_e,
+			float c_f,
+			float e_f) {
+
+			Eigen::Vector4f crossing;
+			if(!edge_crossing(e, p, h_e, c_f, e_f, crossing))
+				return;
+			edges[e][coord] = crossing;
+
+			//Mark neighboring vertices
+			const int u_dir = (e+1)%3;
+			const int v_dir = (e+2)%3;
+			for(int u=0; u<=1; ++u) {
+				if(coord[u_dir]-u < 0)
+					continue;
+				for(int v=0; v<=1; ++v) {
+					if(coord[v_dir]-v < 0)
+						continue;
+					Eigen::Vector3i tmp(coord);
+					tmp[u_dir] -= u;
+					tmp[v_dir] -= v;
+					vertices[tmp] = -1;
+				}
+			}
+		}
+
+		/**
+		 * Places a vertex in every marked cell and generates the faces dual to
+		 * the crossing edges.  res is the size of the (padded) cell grid.
+		 */
+		template<typename Mesh, typename AttributeFunc>
+		void extract(
+			Mesh& mesh,
+			AttributeFunc& attr,
+			Eigen::Vector3i const& res) {
+			place_vertices(mesh, attr);
+			generate_faces(mesh, res);
+		}
+
+		/**
+		 * Places the vertex of each marked cell at the average of the crossings
+		 * on its edges.
+		 */
+		template<typename Mesh, typename AttributeFunc>
+		void place_vertices(
+			Mesh& mesh,
+			AttributeFunc& attr) {
+
+			//Compute vertices
+			for(auto iter=vertices.begin(); iter!=vertices.end(); ++iter) {
+				Eigen::Vector3f center, gradient;
+				cell_center(iter->first, center, gradient);
+				iter->second = mesh.add_vertex(make_vertex(attr, center, gradient));
+			}
+		}
+
+		/**
+		 * Computes the average of the crossings on the edges of cell, and
+		 * estimates the gradient of f from the average slope of the crossing
+		 * edges along each axis (0 along axes with no crossing).  Returns false
+		 * if none of its edges cross.
+		 */
+		bool cell_center(
+			Eigen::Vector3i const& cell,
+			Eigen::Vector3f& result,
+			Eigen::Vector3f& gradient) const {
+
+			int n = 0;
+			Eigen::Vector4f center(0, 0, 0, 0);
+			gradient = Eigen::Vector3f(0, 0, 0);
+
+			//Read in all the planes
+			for(int e=0; e<3; ++e) {
+				const int u_dir = (e + 1)%3;
+				const int v_dir = (e + 2)%3;
+				int n_e = 0;
+
+				for(int u=0; u<=1; ++u)
+				for(int v=0; v<=1; ++v) {
+
+					Eigen::Vector3i tmp(cell);
+					tmp[u_dir] += u;
+					tmp[v_dir] += v;
+
+					auto e_iter = edges[e].find(tmp);
+					if(e_iter == edges[e].end())
+						continue;
+
+					center += e_iter->second;
+					gradient[e] += e_iter->second[3];
+					++n;
+					++n_e;
+				}
+
+				if(n_e > 0)
+					gradient[e] /= (float)n_e;
+			}
+
+			if(n == 0)
+				return false;
+			center /= (float)n;
+			result = Eigen::Vector3f(center[0], center[1], center[2]);
+			return true;
+		}
+
+		/**
+		 * Generates the quads dual to the crossing edges from the cell vertices.
+		 * Triangles which collapse because several cells share a vertex are
+		 * skipped.
+		 */
+		template<typename Mesh>
+		void generate_faces(
+			Mesh& mesh,
+			Eigen::Vector3i const& res) {
+
+			//Generate faces
+			int tris[2];
+			for(int e=0; e<3; ++e) {
+				for(auto iter=edges[e].begin(); iter!=edges[e].end(); ++iter) {
+					add_faces(mesh, e, iter->first, iter->second, res, tris);
+				}
+			}
+		}
+
+		/**
+		 * Generates the quad dual to a single crossing edge, skipping edges on
+		 * the boundary of the (padded) grid.  Stores the names of the two new
+		 * triangles in tris, or -1 for a triangle which was not created.
+		 */
+		template<typename Mesh>
+		void add_faces(
+			Mesh& mesh,
+			int e,
+			Eigen::Vector3i const& coord,
+			Eigen::Vector4f const& crossing,
+			Eigen::Vector3i const& res,
+			int* tris) {
+
+			const int u_dir = (e+1) % 3;
+			const int v_dir = (e+2) % 3;
+			int vert[4], n=0;
+
+			tris[0] = tris[1] = -1;
+			if(	coord[u_dir] <= 0 || coord[v_dir] <= 0 ||
+				coord[u_dir] >= res[u_dir]-1 ||
+				coord[v_dir] >= res[v_dir]-1 ||
+				coord[e] >= res[e] - 2)
+				return;
+
+			for(int u=0; u<=1; ++u)
+			for(int v=0; v<=1; ++v) {
+				Eigen::Vector3i tmp(coord);
+				tmp[u_dir] -= u;
+				tmp[v_dir] -= v;
+				vert[n++] = vertices[tmp];
+			}
+
+			if(crossing[3] < 0) {
+				tris[0] = add_face(mesh, vert[0], vert[1], vert[2]);
+				tris[1] = add_face(mesh, vert[2], vert[1], vert[3]);
+			}
+			else {
+				tris[0] = add_face(mesh, vert[0], vert[2], vert[1]);
+				tris[1] = add_face(mesh, vert[1], vert[2], vert[3]);
+			}
+		}
+
+	private:
+		template<typename Mesh>
+		static int add_face(Mesh& mesh, int v0, int v1, int v2) {
+			if(v0 == v1 || v1 == v2 || v2 == v0)
+				return -1;
+			return mesh.add_triangle(v0, v1, v2);
+		}
+	};
+
+	/**
+	 * Samples f over the grid lo + (x,y,z) * h, 0 <= x,y,z <= res, one z slab
+	 * at a time, and records every edge crossing in cells.
+	 */
+	template<typename DensityFunc>
+	void sweep_edges(
+		DensityFunc& f,
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& h,
+		Eigen::Vector3i const& res,
+		ContourCells& cells) {
+
+		//Initialize slab buffers
+		const int nx = res[0] + 1, ny = res[1] + 1;
+
+		float* above = new float[nx * ny];
+		float* below = new float[nx * ny];
+		ScopedArray<float> aguard(above), bguard(below);
+
+		sample_slab(f, lo, h, 0, nx, ny, below);
+
+		for(int z=0; z<res[2]; ++z) {
+			sample_slab(f, lo, h, z+1, nx, ny, above);
+
+			for(int x=0; x<res[0]; ++x) {
+				for(int y=0; y<res[1]; ++y) {
+					const Eigen::Vector3i coord(x, y, z);
+					const int idx = x * ny + y;
+
+					//Read off function values
+					const Eigen::Vector3f p = (Eigen::Array3f(x,y,z) * h.array() + lo.array()).matrix();
+					const float c_f = below[idx];
+					const Eigen::Vector3f e_f(below[idx+ny], below[idx+1], above[idx]);
+
+					//Compute edge intersections
+					for(int e=0; e<3; ++e) {
+						cells.add_edge(coord, e, p, h[e], c_f, e_f[e]);
+					}
+				}
+			}
+
+			//Swap arrays
+			std::swap(above, below);
+		}
+	}
+
+	/**
+	 * Samples the grid points in the box [n_lo,n_hi] of the grid
+	 * lo + (x,y,z) * h as rows along y, and records the crossings of the edges
+	 * inside the box which sweep_edges would visit.  values must have room
+	 * for all the points of the box.
+	 */
+	template<typename DensityFunc>
+	void sweep_block(
+		DensityFunc& f,
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& h,
+		Eigen::Vector3i const& res,
+		Eigen::Vector3i const& n_lo,
+		Eigen::Vector3i const& n_hi,
+		float* values,
+		ContourCells& cells) {
+
+		//Sample block as rows along y
+		const Eigen::Vector3i n = n_hi - n_lo + Eigen::Vector3i(1, 1, 1);
+		const Eigen::Vector3f step(0, h[1], 0);
+		for(int z=0; z<n[2]; ++z)
+		for(int x=0; x<n[0]; ++x) {
+			const Eigen::Vector3f origin = ((n_lo + Eigen::Vector3i(x, 0, z)).cast<float>().array() * h.array() + lo.array()).matrix();
+			sample_row(f, origin, step, n[1], values + (z * n[0] + x) * n[1]);
+		}
+
+		//Find edge intersections, restricted to the edges the dense sweep visits
+		for(int z=0; z<n[2]; ++z)
+		for(int x=0; x<n[0]; ++x)
+		for(int y=0; y<n[1]; ++y) {
+			const Eigen::Vector3i local(x, y, z);
+			const Eigen::Vector3i coord = n_lo + local;
+			if((coord.array() >= res.array()).any())
+				continue;
+
+			const Eigen::Vector3f p = (coord.cast<float>().array() * h.array() + lo.array()).matrix();
+			const int idx = (z * n[0] + x) * n[1] + y;
+			const int stride[3] = { n[1], 1, n[0] * n[1] };
+			for(int e=0; e<3; ++e) {
+				if(local[e] + 1 >= n[e])
+					continue;
+				cells.add_edge(coord, e, p, h[e], values[idx], values[idx + stride[e]]);
+			}
+		}
+	}
+
+	/**
+	 * Samples the grid points of the active blocks of k cells of the grid
+	 * lo + (x,y,z) * h, and records the crossings of the edges inside them
+	 * which sweep_edges would visit.  Block (x,y,z) covers the points from
+	 * k * (x,y,z) to min(k * (x,y,z) + k, res), and is active when
+	 * active[(z * nb[0] + x) * nb[1] + y] is set.
+	 *
+	 * The blocks are swept one slab of blocks at a time, into k + 1 layers
+	 * of points whose top layer becomes the bottom of the next slab, so the
+	 * points shared by neighboring blocks are sampled once.
+	 */
+	template<typename DensityFunc>
+	void sweep_blocks(
+		DensityFunc& f,
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& h,
+		Eigen::Vector3i const& res,
+		int k,
+		Eigen::Vector3i const& nb,
+		std::vector<char> const& active,
+		ContourCells& cells) {
+
+		const int nx = res[0] + 1, ny = res[1] + 1, layer = nx * ny;
+		std::vector<float> values((k + 1) * layer);
+		std::vector<char> sampled((k + 1) * layer, 0);
+		const Eigen::Vector3f row_step(0, h[1], 0);
+
+		for(int z=0; z<nb[2]; ++z) {
+			if(z > 0) {
+				std::copy(values.begin() + k * layer, values.end(), values.begin());
+				std::copy(sampled.begin() + k * layer, sampled.end(), sampled.begin());
+				std::fill(sampled.begin() + layer, sampled.end(), 0);
+			}
+
+			for(int x=0; x<nb[0]; ++x)
+			for(int y=0; y<nb[1]; ++y) {
+				if(!active[(z * nb[0] + x) * nb[1] + y])
+					continue;
+				const Eigen::Vector3i n_lo(x * k, y * k, z * k);
+				const Eigen::Vector3i n_hi = (n_lo.array() + k).min(res.array()).matrix();
+
+				//Sample the rows of the block in runs which only depend on the
+				//block row, so that a point is evaluated the same way whichever
+				//block samples it:  the points on the faces along y, and the
+				//points between them
+				const int starts[3] = { n_lo[1], n_lo[1] + 1, n_lo[1] + k };
+				const int ends[3] = { n_lo[1], n_lo[1] + k - 1, n_lo[1] + k };
+				for(int fz=n_lo[2]; fz<=n_hi[2]; ++fz)
+				for(int fx=n_lo[0]; fx<=n_hi[0]; ++fx) {
+					const int row = (fz - n_lo[2]) * layer + fx * ny;
+					for(int i=0; i<3; ++i) {
+						const int first = starts[i], last = std::min(ends[i], n_hi[1]);
+						if(first > last || sampled[row + first])
+							continue;
+						const Eigen::Vector3f origin = (Eigen::Array3f(fx, first, fz) * h.array() + lo.array()).matrix();
+						sample_row(f, origin, row_step, last - first + 1, &values[row + first]);
+						std::fill(sampled.begin() + row + first, sampled.begin() + row + last + 1, 1);
+					}
+				}
+			}
+
+			//Record the crossings of the edges inside the active blocks
+			//which the dense sweep visits.  An edge on the boundary of
+			//several active blocks is recorded by the first of them.
+			for(int x=0; x<nb[0]; ++x)
+			for(int y=0; y<nb[1]; ++y) {
+				if(!active[(z * nb[0] + x) * nb[1] + y])
+					continue;
+				const Eigen::Vector3i block(x, y, z);
+				const Eigen::Vector3i n_lo = k * block;
+				const Eigen::Vector3i n_hi = (n_lo.array() + k).min(res.array()).matrix();
+
+				for(int fz=n_lo[2]; fz<=n_hi[2]; ++fz)
+				for(int fx=n_lo[0]; fx<=n_hi[0]; ++fx)
+				for(int fy=n_lo[1]; fy<=n_hi[1]; ++fy) {
+					const Eigen::Vector3i coord(fx, fy, fz);
+					if((coord.array() >= res.array()).any())
+						continue;
+
+					const Eigen::Vector3f p = (coord.cast<float>().array() * h.array() + lo.array()).matrix();
+					const int idx = (fz - n_lo[2]) * layer + fx * ny + fy;
+					const int stride[3] = { ny, 1, layer };
+					for(int e=0; e<3; ++e) {
+						if(coord[e] + 1 > n_hi[e])
+							continue;
+
+						//Blocks which also contain the edge
+						Eigen::Vector3i first = block, last = block;
+						for(int i=0; i<3; ++i) {
+							if(i == e)
+								continue;
+							if(coord[i] == n_lo[i] && block[i] > 0)
+								--first[i];
+							if(coord[i] == n_hi[i] && block[i] + 1 < nb[i])
+								++last[i];
+						}
+						int owner = -1;
+						for(int bz=first[2]; owner < 0 && bz<=last[2]; ++bz)
+						for(int bx=first[0]; owner < 0 && bx<=last[0]; ++bx)
+						for(int by=first[1]; owner < 0 && by<=last[1]; ++by) {
+							if(active[(bz * nb[0] + bx) * nb[1] + by])
+								owner = (bz * nb[0] + bx) * nb[1] + by;
+						}
+						if(owner == (z * nb[0] + x) * nb[1] + y)
+							cells.add_edge(coord, e, p, h[e], values[idx], values[idx + stride[e]]);
+					}
+				}
+			}
+		}
+	}
+};
+
 /**
  * Computes a mesh estimate for the 0-level set of the given function.
  * Note:  Will evaluate the function f outside the region [lo,hi] in order
  * to acheive correct behaviour at the boundary.
  *
- * 
+ *
  *  Mesh is of type TriMesh<VertexData>
- *  DensityFunc is a lambda of type Eigen::Vector3f -> float
+ *  DensityFunc is a lambda of type Eigen::Vector3f -> float, optionally with
+ *    a batched row evaluator (see mesh/algorithms/density.h) which is
+ *    preferred when present
  *  AttributeFunc is a lambda of type Eigen::Vector3f -> VertexData
  *
+ * If f implements bounds, the grid is swept in blocks of CONTOUR_BOUNDS_BLOCK
+ * cells instead, and blocks which f is safely positive or negative on are
+ * skipped without being sampled.  The points shared by neighboring blocks
+ * are sampled once, which takes CONTOUR_BOUNDS_BLOCK + 1 layers of samples.
  */
 template<
 	typename Mesh,
@@ -38,184 +500,319 @@ void isocontour(
 	Vector lo,
 	Vector hi,
 	Eigen::Vector3i res) {
-	
-	//Edge intersections
-	typename impl::SpatialGrid<Eigen::Vector4f>::type edges[3];
-	
-	//Mesh vertices
-	typename impl::SpatialGrid<int>::type vertices;	
-	
+
+	impl::ContourCells cells;
+
 	//Grid size
-	auto h = (hi - lo).array() / Vector(res[0], res[1], res[2]).array();
-	lo -= h.matrix();
+	const Vector h = ((hi - lo).array() / Vector(res[0], res[1], res[2]).array()).matrix();
+	lo -= h;
 	for(int i=0; i<3; ++i)
 		res[i] += 2;
-	
-	
-	//Find edge intersections
-	{
-		//Initialize edge bounds
-		const size_t sz = (res[0] + 1) * (res[1] + 1);
-	
-		float* above = new float[sz];
-		float* below = new float[sz];
-		impl::ScopedArray<float> aguard(above), bguard(below);
-		
-		int idx = 0;
-		for(int x=0; x<=res[0]; ++x)
-		for(int y=0; y<=res[1]; ++y) {
-			below[idx++] = f((Vector(x,y,0).array() * h + lo.array()).matrix());
-		}
-		
-		for(int z=0; z<res[2]; ++z) {
-			//Initialize array
-			idx = 0;
-			for(int x=0; x<res[0]; ++x) {
-				for(int y=0; y<res[1]; ++y) {
-					const Eigen::Vector3i coord(x, y, z);
-			
-					//Evaluate necessary function values
-					const Vector p = (Eigen::Array3f(x,y,z) * h + lo.array()).matrix();
-					float z_f = above[idx] = f(p + Eigen::Vector3f(0, 0, h[2]));
-					const float c_f = below[idx];
-					++idx;
-					const Vector e_f(below[idx+res[1]], below[idx], z_f);
-			
-					//Compute edge intersection
-					for(int e=0; e<3; ++e) {
-			
-						//Do edge intersection test
-						if(c_f < -FP_TOLERANCE) {
-							if(e_f[e] < -FP_TOLERANCE) {
-								continue;
-							}
-						}
-						else if(c_f > FP_TOLERANCE) {
-							if(e_f[e] > FP_TOLERANCE) {
-								continue;
-							}
-						}
-						else {
-							if(abs(e_f[e]) < FP_TOLERANCE) {
-								continue;
-							}
-						}
-				
-						//Find intercept
-						Eigen::Vector3f e_p(p);
-						e_p[e] += h[e];
-						const float t = c_f / (c_f - e_f[e]);
-						const Eigen::Vector3f intercept = (1.-t)*p + t*e_p;
-						edges[e][coord] = Eigen::Vector4f(
-							intercept[0], intercept[1], intercept[2], (c_f < e_f[e]) ? 1 : -1);
-		
-						//Mark neighboring vertices
-						for(int k=0; k<3; ++k) {
-							if(coord[k] == res[k]-1)
-								continue;
-						}
-						
-						const int u_dir = (e+1)%3;
-						const int v_dir = (e+2)%3;
-						for(int u=0; u<=1; ++u) {
-							if(coord[u_dir]-u < 0)
-								continue;
-							for(int v=0; v<=1; ++v) {
-								if(coord[v_dir]-v < 0)
-									continue;
-								Eigen::Vector3i tmp(coord);
-								tmp[u_dir] -= u;
-								tmp[v_dir] -= v;
-								vertices[tmp] = -1;
-							}
-						}
-					}
-				}
-				above[idx++] = f((Eigen::Array3f(x,res[1],z+1) * h + lo.array()).matrix());				
-			}
-			
-			if(z < res[2]) {
-				//Fill in the x-row
-				Eigen::Vector3f p = (Eigen::Array3f(res[0],0,z+1) * h + lo.array()).matrix();
-				for(int y=0; y<res[1]; ++y, p[1] += h[1]) {
-					above[idx++] = f(p);
-				}
-						
-				//Swap arrays
-				float* tmp = above;
-				above = below;
-				below = tmp;
+
+	if(!impl::has_density_bounds<DensityFunc>::value) {
+		impl::sweep_edges(f, lo, h, res, cells);
+		cells.extract(mesh, attr, res);
+		return;
+	}
+
+	//Sweep the blocks which may contain the surface
+	const int block = CONTOUR_BOUNDS_BLOCK;
+	Eigen::Vector3i nb;
+	for(int i=0; i<3; ++i)
+		nb[i] = (res[i] + block - 1) / block;
+
+	std::vector<char> active(nb[0] * nb[1] * nb[2], 0);
+	for(int z=0; z<nb[2]; ++z)
+	for(int x=0; x<nb[0]; ++x)
+	for(int y=0; y<nb[1]; ++y) {
+		const Eigen::Vector3i n_lo(x * block, y * block, z * block);
+		const Eigen::Vector3i n_hi = (n_lo.array() + block).min(res.array()).matrix();
+		const Vector b_lo = (n_lo.cast<float>().array() * h.array() + lo.array()).matrix();
+		const Vector b_hi = (n_hi.cast<float>().array() * h.array() + lo.array()).matrix();
+		active[(z * nb[0] + x) * nb[1] + y] = impl::may_cross(f, b_lo, b_hi);
+	}
+	impl::sweep_blocks(f, lo, h, res, block, nb, active, cells);
+
+	cells.extract(mesh, attr, res);
+}
+
+/**
+ * Adaptive version of isocontour.
+ *
+ * Produces the same surface as isocontour(mesh, f, attr, lo, hi, res), but
+ * only samples f inside the leaves of an octree over the grid which may
+ * contain the 0-level set.  A node is discarded when the bound on f over its
+ * box excludes 0, so for well behaved densities the number of evaluations is
+ * proportional to the area of the surface rather than the volume of [lo,hi].
+ *
+ *  BoundFunc is a lambda of type (Eigen::Vector3f lo, Eigen::Vector3f hi) ->
+ *    Eigen::Vector2f, returning a range [min,max] containing every value of f
+ *    on the closed box [lo,hi] (see LipschitzBound)
+ *  leaf_size is the edge length in cells of the octree leaves, which are
+ *    sampled densely.  Must be a power of 2.
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename AttributeFunc,
+	typename BoundFunc,
+	typename Vector>
+void isocontour_adaptive(
+	Mesh& mesh,
+	DensityFunc& f,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector hi,
+	Eigen::Vector3i res,
+	BoundFunc& bound,
+	int leaf_size = 4) {
+
+	assert(leaf_size > 0 && (leaf_size & (leaf_size - 1)) == 0);
+
+	impl::ContourCells cells;
+
+	//Grid size
+	const Vector h = ((hi - lo).array() / Vector(res[0], res[1], res[2]).array()).matrix();
+	lo -= h;
+	for(int i=0; i<3; ++i)
+		res[i] += 2;
+
+	//Octree root covers the padded grid
+	int root_size = leaf_size;
+	while(root_size < res.maxCoeff())
+		root_size *= 2;
+
+	//Leaf sample buffer
+	const int nb = leaf_size + 1;
+	float* values = new float[nb * nb * nb];
+	impl::ScopedArray<float> vguard(values);
+
+	//To-visit stack of (origin, size) nodes
+	std::vector< std::pair<Eigen::Vector3i, int> > to_visit;
+	to_visit.push_back(std::make_pair(Eigen::Vector3i(0, 0, 0), root_size));
+
+	while(to_visit.size() > 0) {
+		const Eigen::Vector3i n_lo = to_visit.back().first;
+		const int size = to_visit.back().second;
+		to_visit.pop_back();
+
+		//Clip node against grid
+		if((n_lo.array() >= res.array()).any())
+			continue;
+		const Eigen::Vector3i n_hi = (n_lo.array() + size).min(res.array()).matrix();
+
+		//Test bound
+		const Vector b_lo = (n_lo.cast<float>().array() * h.array() + lo.array()).matrix();
+		const Vector b_hi = (n_hi.cast<float>().array() * h.array() + lo.array()).matrix();
+		const Eigen::Vector2f range = bound(b_lo, b_hi);
+		if(range[0] > FP_TOLERANCE || range[1] < -FP_TOLERANCE)
+			continue;
+
+		//Subdivide
+		if(size > leaf_size) {
+			const int half = size / 2;
+			for(int i=0; i<8; ++i) {
+				to_visit.push_back(std::make_pair(
+					Eigen::Vector3i(
+						n_lo[0] + ((i&1) ? half : 0),
+						n_lo[1] + ((i&2) ? half : 0),
+						n_lo[2] + ((i&4) ? half : 0)),
+					half));
 			}
+			continue;
 		}
+
+		impl::sweep_block(f, lo, h, res, n_lo, n_hi, values, cells);
 	}
-		
-	
-	//Compute vertices
-	for(auto iter=vertices.begin(); iter!=vertices.end(); ++iter) {
-		int n = 0;
-		Eigen::Vector4f center(0, 0, 0, 0);
-		
-		//Read in all the planes
-		for(int e=0; e<3; ++e) {
-			const int u_dir = (e + 1)%3;
-			const int v_dir = (e + 2)%3;
 
-			for(int u=0; u<=1; ++u)
-			for(int v=0; v<=1; ++v) {
-			
-				Eigen::Vector3i tmp(iter->first);
-				tmp[u_dir] += u;
-				tmp[v_dir] += v;
-				
-				auto e_iter = edges[e].find(tmp);
-				if(e_iter == edges[e].end())
-					continue;
-					
-				center += e_iter->second;
-				++n;
-			}
+	cells.extract(mesh, attr, res);
+}
+
+/**
+ * Adaptive isocontour for a density with Lipschitz constant lipschitz, ie
+ * |f(p) - f(q)| <= lipschitz * |p - q|.
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename AttributeFunc,
+	typename Vector>
+void isocontour_adaptive(
+	Mesh& mesh,
+	DensityFunc& f,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector hi,
+	Eigen::Vector3i res,
+	float lipschitz,
+	int leaf_size = 4) {
+
+	LipschitzBound<DensityFunc> bound(f, lipschitz);
+	isocontour_adaptive(mesh, f, attr, lo, hi, res, bound, leaf_size);
+}
+
+/**
+ * Narrow band version of isocontour.
+ *
+ * Samples f on a coarse grid with coarse_factor cells per coarse cell first,
+ * and then samples the full resolution grid only inside the coarse cells
+ * whose corners straddle 0, dilated by dilation coarse cells in every
+ * direction.  For a surface like a terrain this takes O(res^2) rather than
+ * O(res^3) evaluations, and needs no bound on f.  Each fine point is sampled
+ * at most once, the points shared by neighboring band blocks included, which
+ * takes k + 1 layers of fine samples (k = coarse_factor).
+ *
+ * The result is the same as isocontour except for parts of the surface which
+ * pass between the coarse samples without changing the sign of any of them
+ * within dilation coarse cells:  closed features (bubbles, floating pieces)
+ * and thin sheets or tunnels smaller than about coarse_factor cells, which
+ * are not near another part of the surface, may be dropped.  Increase
+ * dilation or decrease coarse_factor to keep smaller features.
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename AttributeFunc,
+	typename Vector>
+void isocontour_narrowband(
+	Mesh& mesh,
+	DensityFunc& f,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector hi,
+	Eigen::Vector3i res,
+	int coarse_factor = 4,
+	int dilation = 1) {
+
+	assert(coarse_factor > 0 && dilation >= 0);
+
+	impl::ContourCells cells;
+
+	//Grid size
+	const Vector h = ((hi - lo).array() / Vector(res[0], res[1], res[2]).array()).matrix();
+	lo -= h;
+	for(int i=0; i<3; ++i)
+		res[i] += 2;
+
+	//Coarse grid, whose last points may lie past the end of the fine grid
+	const int k = coarse_factor;
+	Eigen::Vector3i nc;
+	for(int i=0; i<3; ++i)
+		nc[i] = (res[i] + k - 1) / k;
+	const Eigen::Vector3i np = nc + Eigen::Vector3i(1, 1, 1);
+
+	std::vector<float> coarse(np[0] * np[1] * np[2]);
+	const Eigen::Vector3f step(0, k * h[1], 0);
+	for(int z=0; z<np[2]; ++z)
+	for(int x=0; x<np[0]; ++x) {
+		const Vector origin = (Eigen::Array3f(x * k, 0, z * k) * h.array() + lo.array()).matrix();
+		impl::sample_row(f, origin, step, np[1], &coarse[(z * np[0] + x) * np[1]]);
+	}
+
+	//Mark coarse cells which straddle 0 and their neighbors
+	std::vector<char> band(nc[0] * nc[1] * nc[2], 0);
+	for(int z=0; z<nc[2]; ++z)
+	for(int x=0; x<nc[0]; ++x)
+	for(int y=0; y<nc[1]; ++y) {
+		bool pos = false, neg = false;
+		for(int c=0; c<8; ++c) {
+			const float v = coarse[((z + (c>>2)) * np[0] + x + (c&1)) * np[1] + y + ((c>>1)&1)];
+			pos = pos || v > -FP_TOLERANCE;
+			neg = neg || v < FP_TOLERANCE;
+		}
+		if(!(pos && neg))
+			continue;
+
+		for(int dz=std::max(z-dilation, 0); dz<=std::min(z+dilation, nc[2]-1); ++dz)
+		for(int dx=std::max(x-dilation, 0); dx<=std::min(x+dilation, nc[0]-1); ++dx)
+		for(int dy=std::max(y-dilation, 0); dy<=std::min(y+dilation, nc[1]-1); ++dy) {
+			band[(dz * nc[0] + dx) * nc[1] + dy] = 1;
 		}
-		
-		center /= (float)n;
-		iter->second = mesh.add_vertex(attr(Eigen::Vector3f(center[0], center[1], center[2])));
 	}
-	
-	//Generate faces
-	for(int e=0; e<3; ++e) {
-		const int u_dir = (e+1) % 3;
-		const int v_dir = (e+2) % 3;
-		
-		for(auto iter=edges[e].begin(); iter!=edges[e].end(); ++iter) {
-			auto coord = iter->first;
-			int vert[4], n=0;
-			
-			if(	coord[u_dir] <= 0 || coord[v_dir] <= 0 ||
-				coord[u_dir] >= res[u_dir]-1 || 
-				coord[v_dir] >= res[v_dir]-1 || 
-				coord[e] >= res[e] - 2)
-				continue;
-			
-			for(int u=0; u<=1; ++u)
-			for(int v=0; v<=1; ++v) {
-				Eigen::Vector3i tmp(coord);
-				tmp[u_dir] -= u;
-				tmp[v_dir] -= v;				
-				vert[n++] = vertices[tmp];
-			}		
-		
-			if(iter->second[3] < 0) {
-				mesh.add_triangle(vert[0], vert[1], vert[2]);
-				mesh.add_triangle(vert[2], vert[1], vert[3]);
-			}
-			else {
-				mesh.add_triangle(vert[0], vert[2], vert[1]);
-				mesh.add_triangle(vert[1], vert[2], vert[3]);		
+
+	//Sample the fine grid inside the band
+	impl::sweep_blocks(f, lo, h, res, k, nc, band, cells);
+
+	cells.extract(mesh, attr, res);
+}
+
+/**
+ * Contours several level sets of f in one pass.  Produces in meshes[i] the
+ * same surface as isocontour(meshes[i], g, attr, lo, hi, res) for
+ * g(p) = f(p) - isovalues[i], but samples f only once for all levels.
+ *
+ *  isovalues must be sorted in increasing order.  meshes is resized to
+ *    hold one mesh per isovalue.
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename AttributeFunc,
+	typename Vector>
+void isocontour_levels(
+	std::vector<Mesh>& meshes,
+	DensityFunc& f,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector hi,
+	Eigen::Vector3i res,
+	std::vector<float> const& isovalues) {
+
+	assert(std::is_sorted(isovalues.begin(), isovalues.end()));
+
+	const int n_levels = (int)isovalues.size();
+	meshes.resize(n_levels);
+	std::vector<impl::ContourCells> cells(n_levels);
+
+	//Grid size
+	const Vector h = ((hi - lo).array() / Vector(res[0], res[1], res[2]).array()).matrix();
+	lo -= h;
+	for(int i=0; i<3; ++i)
+		res[i] += 2;
+
+	//Initialize slab buffers
+	const int nx = res[0] + 1, ny = res[1] + 1;
+
+	float* above = new float[nx * ny];
+	float* below = new float[nx * ny];
+	impl::ScopedArray<float> aguard(above), bguard(below);
+
+	impl::sample_slab(f, lo, h, 0, nx, ny, below);
+
+	for(int z=0; z<res[2]; ++z) {
+		impl::sample_slab(f, lo, h, z+1, nx, ny, above);
+
+		for(int x=0; x<res[0]; ++x) {
+			for(int y=0; y<res[1]; ++y) {
+				const Eigen::Vector3i coord(x, y, z);
+				const int idx = x * ny + y;
+
+				//Read off function values
+				const Eigen::Vector3f p = (Eigen::Array3f(x,y,z) * h.array() + lo.array()).matrix();
+				const float c_f = below[idx];
+				const Eigen::Vector3f e_f(below[idx+ny], below[idx+1], above[idx]);
+
+				//Test each edge only against the isovalues between its end points
+				for(int e=0; e<3; ++e) {
+					const float v_lo = std::min(c_f, e_f[e]) - FP_TOLERANCE;
+					const float v_hi = std::max(c_f, e_f[e]) + FP_TOLERANCE;
+					const int first = std::lower_bound(isovalues.begin(), isovalues.end(), v_lo) - isovalues.begin();
+					for(int l=first; l<n_levels && isovalues[l]<=v_hi; ++l) {
+						cells[l].add_edge(coord, e, p, h[e], c_f - isovalues[l], e_f[e] - isovalues[l]);
+					}
+				}
 			}
 		}
+
+		//Swap arrays
+		std::swap(above, below);
+	}
+
+	for(int l=0; l<n_levels; ++l) {
+		cells[l].extract(meshes[l], attr, res);
 	}
 }
 
 };
 
 #endif
-
@@ -0,0 +1,229 @@
+#ifndef MESH_CONTOUR_CONTEXT_H
+#define MESH_CONTOUR_CONTEXT_H
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+#include "mesh/core/trimesh.h"
+#include "mesh/algorithms/density.h"
+#include "mesh/algorithms/contour.h"
+
+namespace Mesh {
+
+/**
+ * Incrementally updated isocontour.
+ *
+ * Contours f into mesh like isocontour(mesh, f, attr, lo, hi, res), but keeps
+ * the sampled grid, the edge crossings, the cell vertices and the triangles of
+ * every crossing between calls.  When f changes inside a box, update(lo, hi)
+ * resamples only the grid points in the box and replaces only the vertices and
+ * triangles which depend on them, so the cost of an edit is proportional to
+ * the size of the edit rather than of the domain.
+ *
+ * The context refers to vertices and triangles of mesh by name, so the mesh
+ * must not be garbage collected or modified elsewhere while the context is in
+ * use.
+ *
+ *  Mesh is of type TriMesh<VertexData>
+ *  DensityFunc is a lambda of type Eigen::Vector3f -> float, optionally with
+ *    a batched row evaluator (see mesh/algorithms/density.h)
+ *  AttributeFunc is a lambda of type Eigen::Vector3f -> VertexData
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename AttributeFunc>
+struct ContourContext {
+
+	/**
+	 * Creates a context for the grid of res cells over [lo,hi], and contours
+	 * the initial surface into mesh.
+	 */
+	ContourContext(
+		Mesh& mesh_,
+		DensityFunc& f_,
+		AttributeFunc& attr_,
+		Eigen::Vector3f const& lo_,
+		Eigen::Vector3f const& hi_,
+		Eigen::Vector3i const& res_) :
+		mesh(mesh_),
+		f(f_),
+		attr(attr_) {
+
+		//Grid size, padded as in isocontour
+		h = ((hi_ - lo_).array() / res_.cast<float>().array()).matrix();
+		lo = lo_ - h;
+		res = res_ + Eigen::Vector3i(2, 2, 2);
+
+		samples.resize((res[0]+1) * (res[1]+1) * (res[2]+1));
+		update();
+	}
+
+	///Resamples and re-contours the whole grid
+	void update() {
+		update_points(Eigen::Vector3i(0, 0, 0), res);
+	}
+
+	/**
+	 * Re-contours after f changed inside the box [dirty_lo,dirty_hi].  Grid
+	 * points in the box are resampled, and the vertices and triangles of the
+	 * surrounding cells are replaced.
+	 */
+	void update(
+		Eigen::Vector3f const& dirty_lo,
+		Eigen::Vector3f const& dirty_hi) {
+
+		Eigen::Vector3i p0, p1;
+		for(int i=0; i<3; ++i) {
+			p0[i] = std::max(0,			(int)std::floor((dirty_lo[i] - lo[i]) / h[i]));
+			p1[i] = std::min(res[i],	(int)std::ceil((dirty_hi[i] - lo[i]) / h[i]));
+			if(p0[i] > p1[i])
+				return;
+		}
+		update_points(p0, p1);
+	}
+
+private:
+
+	int point_index(Eigen::Vector3i const& p) const {
+		return (p[2] * (res[0]+1) + p[0]) * (res[1]+1) + p[1];
+	}
+
+	///Returns 1 or -1 if the sample at p is safely positive or negative, 0 otherwise
+	int point_sign(Eigen::Vector3i const& p) const {
+		const float v = samples[point_index(p)];
+		return v > FP_TOLERANCE ? 1 : (v < -FP_TOLERANCE ? -1 : 0);
+	}
+
+	///Tests whether any edge of cell may cross the surface
+	bool cell_active(Eigen::Vector3i const& cell) const {
+		const int s = point_sign(cell);
+		if(s == 0)
+			return true;
+		for(int i=1; i<8; ++i) {
+			if(point_sign(Eigen::Vector3i(cell[0] + (i&1), cell[1] + ((i>>1)&1), cell[2] + (i>>2))) != s)
+				return true;
+		}
+		return false;
+	}
+
+	///Updates everything which depends on the grid points in [p0,p1]
+	void update_points(
+		Eigen::Vector3i const& p0,
+		Eigen::Vector3i const& p1) {
+
+		//Edges and cells with a corner in [p0,p1], and the edges with a face
+		//through one of those cells
+		Eigen::Vector3i r0, r1, f1;
+		for(int i=0; i<3; ++i) {
+			r0[i] = std::max(p0[i] - 1, 0);
+			r1[i] = std::min(p1[i], res[i] - 1);
+			f1[i] = std::min(p1[i] + 1, res[i] - 1);
+		}
+
+		//Resample points as rows along y
+		const Eigen::Vector3f step(0, h[1], 0);
+		for(int z=p0[2]; z<=p1[2]; ++z)
+		for(int x=p0[0]; x<=p1[0]; ++x) {
+			const Eigen::Vector3f origin = (Eigen::Array3f(x, p0[1], z) * h.array() + lo.array()).matrix();
+			impl::sample_row(f, origin, step, p1[1] - p0[1] + 1, &samples[point_index(Eigen::Vector3i(x, p0[1], z))]);
+		}
+
+		//Remove old faces
+		for(int e=0; e<3; ++e)
+		for(int z=r0[2]; z<=f1[2]; ++z)
+		for(int x=r0[0]; x<=f1[0]; ++x)
+		for(int y=r0[1]; y<=f1[1]; ++y) {
+			auto iter = faces[e].find(Eigen::Vector3i(x, y, z));
+			if(iter == faces[e].end())
+				continue;
+			for(int i=0; i<2; ++i) {
+				if(iter->second[i] >= 0)
+					mesh.remove_triangle(iter->second[i]);
+			}
+			faces[e].erase(iter);
+		}
+
+		//Remove old vertices
+		for(int z=r0[2]; z<=r1[2]; ++z)
+		for(int x=r0[0]; x<=r1[0]; ++x)
+		for(int y=r0[1]; y<=r1[1]; ++y) {
+			auto iter = cells.vertices.find(Eigen::Vector3i(x, y, z));
+			if(iter == cells.vertices.end())
+				continue;
+			mesh.remove_vertex(iter->second);
+			cells.vertices.erase(iter);
+		}
+
+		//Recompute edge crossings
+		for(int z=r0[2]; z<=r1[2]; ++z)
+		for(int x=r0[0]; x<=r1[0]; ++x)
+		for(int y=r0[1]; y<=r1[1]; ++y) {
+			const Eigen::Vector3i coord(x, y, z);
+			const Eigen::Vector3f p = (coord.cast<float>().array() * h.array() + lo.array()).matrix();
+			const float c_f = samples[point_index(coord)];
+
+			for(int e=0; e<3; ++e) {
+				Eigen::Vector3i n_coord(coord);
+				n_coord[e] += 1;
+
+				Eigen::Vector4f crossing;
+				if(impl::edge_crossing(e, p, h[e], c_f, samples[point_index(n_coord)], crossing)) {
+					cells.edges[e][coord] = crossing;
+				}
+				else {
+					cells.edges[e].erase(coord);
+				}
+			}
+		}
+
+		//Place new vertices
+		for(int z=r0[2]; z<=r1[2]; ++z)
+		for(int x=r0[0]; x<=r1[0]; ++x)
+		for(int y=r0[1]; y<=r1[1]; ++y) {
+			const Eigen::Vector3i coord(x, y, z);
+			Eigen::Vector3f center, gradient;
+			if(cell_active(coord) && cells.cell_center(coord, center, gradient)) {
+				cells.vertices[coord] = mesh.add_vertex(impl::make_vertex(attr, center, gradient));
+			}
+		}
+
+		//Generate new faces
+		for(int e=0; e<3; ++e)
+		for(int z=r0[2]; z<=f1[2]; ++z)
+		for(int x=r0[0]; x<=f1[0]; ++x)
+		for(int y=r0[1]; y<=f1[1]; ++y) {
+			const Eigen::Vector3i coord(x, y, z);
+			auto iter = cells.edges[e].find(coord);
+			if(iter == cells.edges[e].end())
+				continue;
+
+			int tris[2];
+			cells.add_faces(mesh, e, coord, iter->second, res, tris);
+			if(tris[0] >= 0 || tris[1] >= 0) {
+				faces[e][coord] = Eigen::Vector2i(tris[0], tris[1]);
+			}
+		}
+	}
+
+	Mesh&			mesh;
+	DensityFunc&	f;
+	AttributeFunc&	attr;
+
+	//Padded grid
+	Eigen::Vector3f		lo, h;
+	Eigen::Vector3i		res;
+	std::vector<float>	samples;
+
+	//Crossings and cell vertices, and the triangles generated by each crossing
+	impl::ContourCells								cells;
+	typename impl::SpatialGrid<Eigen::Vector2i>::type	faces[3];
+};
+
+};
+
+#endif
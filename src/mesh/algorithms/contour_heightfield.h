@@ -0,0 +1,398 @@
+#ifndef MESH_CONTOUR_HEIGHTFIELD_H
+#define MESH_CONTOUR_HEIGHTFIELD_H
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+#include "mesh/core/trimesh.h"
+#include "mesh/algorithms/density.h"
+#include "mesh/algorithms/contour.h"
+
+namespace Mesh {
+namespace impl {
+
+	///Sign of a sample as seen by edge_crossing:  -1 below, 1 above, 0 on the surface
+	inline int sample_class(float v) {
+		return v < -FP_TOLERANCE ? -1 : (v > FP_TOLERANCE ? 1 : 0);
+	}
+
+	/**
+	 * Samples one column x,z of the grid lo + (x,y,z) * h for the
+	 * heightfield contour.  Points at or below j_below are known to be below
+	 * the surface, and points at or above j_above to be above it, so they are
+	 * never evaluated.
+	 */
+	template<typename DensityFunc>
+	struct HeightColumn {
+		HeightColumn(
+			DensityFunc& f_,
+			Eigen::Vector3f const& lo_,
+			Eigen::Vector3f const& h_,
+			int x_,
+			int z_,
+			int j_below_,
+			int j_above_) :
+			f(f_), lo(lo_), h(h_), x(x_), z(z_), j_below(j_below_), j_above(j_above_) {}
+
+		float value(int j) {
+			if(j <= j_below)
+				return -1.f;
+			if(j >= j_above)
+				return 1.f;
+			return f((Eigen::Array3f(x, j, z) * h.array() + lo.array()).matrix().eval());
+		}
+
+		int sample(int j) {
+			return sample_class(value(j));
+		}
+
+		/**
+		 * Finds the last point below the surface, assuming the column crosses
+		 * it once between a and b.  a and b are only a guess, and are widened
+		 * until a is below the surface and b is not.  Stores in t_hi the last
+		 * point before the column reaches the positive side, which differs from
+		 * the result only when samples lie on the surface.  The samples at the
+		 * result and the point after it are kept in values.
+		 */
+		int find_crossing(int a, int b, int& t_hi) {
+			a = std::min(std::max(a, j_below), j_above - 1);
+			b = std::min(std::max(b, a + 1), j_above);
+
+			//Widen the bracket
+			bool b_known = false;
+			int step = std::max(b - a, 1);
+			while(sample_class(values[0] = value(a)) != -1) {
+				b = a;
+				values[1] = values[0];
+				b_known = true;
+				a = std::max(a - step, j_below);
+				step *= 2;
+			}
+			if(!b_known)
+				values[1] = value(b);
+			step = std::max(b - a, 1);
+			while(sample_class(values[1]) == -1) {
+				a = b;
+				values[0] = values[1];
+				b = std::min(b + step, j_above);
+				values[1] = value(b);
+				step *= 2;
+			}
+
+			//Bisect
+			while(b - a > 1) {
+				const int m = (a + b) / 2;
+				const float m_value = value(m);
+				if(sample_class(m_value) == -1) {
+					a = m;
+					values[0] = m_value;
+				}
+				else {
+					b = m;
+					values[1] = m_value;
+				}
+			}
+
+			//Skip samples on the surface
+			t_hi = a;
+			for(int j=b; sample_class(j == b ? values[1] : value(j)) == 0; ++j) {
+				t_hi = j;
+			}
+			return a;
+		}
+
+		DensityFunc&	f;
+		Eigen::Vector3f	lo, h;
+		int				x, z, j_below, j_above;
+		float			values[2];
+	};
+};
+
+/**
+ * Isocontour for densities which are a bounded perturbation of a height
+ * field, like a terrain f(p) = p.y - height + noise(p).
+ *
+ * The caller declares that f(p) < 0 whenever p.y <= y_min and f(p) > 0
+ * whenever p.y >= y_max.  Instead of sampling the whole grid, every column
+ * along y is searched for its crossing by bracketing and bisection inside
+ * [y_min,y_max], starting from the crossing of the previous column.  The grid
+ * is then sampled only between the crossings of each column and its
+ * neighbors, which is where the edges which cross the surface lie.  Columns
+ * which cross more than once (overhangs, caves or floating pieces), found
+ * either by a scan of every coarse_factor-th column with a stride of
+ * coarse_factor points or while sampling between the crossings, are sampled
+ * over the whole of [y_min,y_max] instead.  A terrain thus costs about
+ * O(res[0] * res[2] * log(res[1])) evaluations rather than
+ * O(res[0] * res[1] * res[2]).
+ *
+ * The result is the same as isocontour, except for overhangs which fall
+ * between the coarse samples without changing the sign of any of them, which
+ * may be dropped or left open like the small features of
+ * isocontour_narrowband.  Decrease coarse_factor to catch smaller overhangs.
+ * Negate f for a density which is positive below the surface.
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename AttributeFunc,
+	typename Vector>
+void isocontour_heightfield(
+	Mesh& mesh,
+	DensityFunc& f,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector hi,
+	Eigen::Vector3i res,
+	float y_min,
+	float y_max,
+	int coarse_factor = 4) {
+
+	assert(coarse_factor > 0 && y_min <= y_max);
+
+	impl::ContourCells cells;
+
+	//Grid size
+	const Vector h = ((hi - lo).array() / Vector(res[0], res[1], res[2]).array()).matrix();
+	lo -= h;
+	for(int i=0; i<3; ++i)
+		res[i] += 2;
+
+	const int nx = res[0] + 1, ny = res[1] + 1, nz = res[2] + 1;
+
+	//Points at or below j_below are below the surface, at or above j_above above it
+	const int j_below = (int)std::floor((y_min - lo[1]) / h[1]);
+	const int j_above = (int)std::ceil((y_max - lo[1]) / h[1]);
+	const int g0 = std::max(j_below, 0), g1 = std::min(j_above, ny - 1);
+	if(g0 > g1)
+		return;
+
+	//Scan coarse columns, recording the scan points around their crossing
+	const int k = coarse_factor;
+	const int ncx = std::max((nx + k - 2) / k, 1), ncz = std::max((nz + k - 2) / k, 1);
+	std::vector<char> coarse_simple((ncx + 1) * (ncz + 1));
+	std::vector<int> coarse_a((ncx + 1) * (ncz + 1)), coarse_b((ncx + 1) * (ncz + 1));
+	for(int cz=0; cz<=ncz; ++cz)
+	for(int cx=0; cx<=ncx; ++cx) {
+		impl::HeightColumn<DensityFunc> column(f, lo, h, std::min(cx * k, nx - 1), std::min(cz * k, nz - 1), j_below, j_above);
+		const int idx = cz * (ncx + 1) + cx;
+
+		int prev = -1, a = g0 - 1, b = g1 + 1;
+		bool simple = true;
+		for(int j=g0; ; j=std::min(j + k, g1)) {
+			const int c = column.sample(j);
+			simple = simple && c >= prev;
+			if(c == -1) {
+				a = j;
+			}
+			else if(prev == -1) {
+				b = j;
+			}
+			prev = c;
+			if(j == g1)
+				break;
+		}
+
+		coarse_simple[idx] = simple ? 1 : 0;
+		coarse_a[idx] = a;
+		coarse_b[idx] = b;
+	}
+
+	//Find the crossings of every column, keeping the samples next to them
+	std::vector<int> t_lo(nx * nz), t_hi(nx * nz), v_lo(nx * nz, 0), v_hi(nx * nz, -1), offset(nx * nz);
+	std::vector<char> full(nx * nz, 0);
+	std::vector<float> values;
+	for(int z=0; z<nz; ++z)
+	for(int x=0; x<nx; ++x) {
+		const int col = z * nx + x;
+		const int bx0 = x > 0 ? std::min((x - 1) / k, ncx - 1) : 0, bx1 = std::min(x / k, ncx - 1);
+		const int bz0 = z > 0 ? std::min((z - 1) / k, ncz - 1) : 0, bz1 = std::min(z / k, ncz - 1);
+
+		//Columns next to a coarse cell which is not a simple height field are
+		//sampled completely below
+		int a = g1 + 1, b = g0 - 1;
+		for(int bz=bz0; bz<=bz1; ++bz)
+		for(int bx=bx0; bx<=bx1; ++bx)
+		for(int c=0; c<4; ++c) {
+			const int idx = (bz + (c>>1)) * (ncx + 1) + bx + (c&1);
+			full[col] = full[col] || !coarse_simple[idx];
+			a = std::min(a, coarse_a[idx]);
+			b = std::max(b, coarse_b[idx]);
+		}
+
+		if(!full[col]) {
+			//The crossing of the previous column is usually the best guess
+			if(x > 0 && !full[col-1]) {
+				a = t_lo[col-1];
+				b = a + 1;
+			}
+			impl::HeightColumn<DensityFunc> column(f, lo, h, x, z, g0 - 1, g1 + 1);
+			t_lo[col] = column.find_crossing(a, b, t_hi[col]);
+
+			v_lo[col] = std::max(t_lo[col], g0);
+			v_hi[col] = std::min(t_lo[col] + 1, g1);
+			offset[col] = (int)values.size();
+			for(int j=v_lo[col]; j<=v_hi[col]; ++j) {
+				values.push_back(column.values[j - t_lo[col]]);
+			}
+
+			//Where the grid clips the window, check the ends of the column
+			if(j_below < g0 && (column.sample(g0) == -1) != (t_lo[col] >= g0))
+				full[col] = 1;
+			if(j_above > g1 && (column.sample(g1) == -1) != (t_lo[col] >= g1))
+				full[col] = 1;
+		}
+
+		//The crossings of complete columns are found when they are sampled
+		if(full[col]) {
+			t_lo[col] = g1 + 1;
+			t_hi[col] = g0 - 1;
+		}
+	}
+
+	//Sample each column between the crossings of itself and its neighbors,
+	//which is where the crossing edges lie.  A column found to cross more
+	//than once is sampled completely, and its neighbors are extended to
+	//match, until no more are found.
+	std::vector<int> s_lo(nx * nz), s_hi(nx * nz);
+	const Vector step(0, h[1], 0);
+	bool changed = true;
+	while(changed) {
+		changed = false;
+
+		for(int z=0; z<nz; ++z)
+		for(int x=0; x<nx; ++x) {
+			const int col = z * nx + x;
+			int lo_j = t_lo[col], hi_j = t_hi[col];
+			if(x > 0) {
+				lo_j = std::min(lo_j, t_lo[col-1]);
+				hi_j = std::max(hi_j, t_hi[col-1]);
+			}
+			if(x+1 < nx) {
+				lo_j = std::min(lo_j, t_lo[col+1]);
+				hi_j = std::max(hi_j, t_hi[col+1]);
+			}
+			if(z > 0) {
+				lo_j = std::min(lo_j, t_lo[col-nx]);
+				hi_j = std::max(hi_j, t_hi[col-nx]);
+			}
+			if(z+1 < nz) {
+				lo_j = std::min(lo_j, t_lo[col+nx]);
+				hi_j = std::max(hi_j, t_hi[col+nx]);
+			}
+			s_lo[col] = std::max(lo_j, g0);
+			s_hi[col] = std::min(hi_j + 1, g1);
+		}
+
+		for(int z=0; z<nz; ++z)
+		for(int x=0; x<nx; ++x) {
+			const int col = z * nx + x;
+			int n_lo = full[col] ? g0 : s_lo[col], n_hi = full[col] ? g1 : s_hi[col];
+			int o_lo = v_lo[col], o_hi = v_hi[col];
+			if(o_lo <= o_hi) {
+				if(n_lo >= o_lo && n_hi <= o_hi)
+					continue;
+				n_lo = std::min(n_lo, o_lo);
+				n_hi = std::max(n_hi, o_hi);
+			}
+
+			//Move the old samples to a larger slot, and sample the rest
+			const int count = n_hi - n_lo + 1;
+			const int n_offset = (int)values.size();
+			values.resize(values.size() + count);
+			if(o_lo <= o_hi) {
+				std::copy(
+					values.begin() + offset[col],
+					values.begin() + offset[col] + (o_hi - o_lo + 1),
+					values.begin() + n_offset + (o_lo - n_lo));
+			}
+			else {
+				o_lo = n_hi + 1;
+				o_hi = n_hi;
+			}
+			if(n_lo < o_lo) {
+				const Vector origin = (Eigen::Array3f(x, n_lo, z) * h.array() + lo.array()).matrix();
+				impl::sample_row(f, origin, step, o_lo - n_lo, &values[n_offset]);
+			}
+			if(o_hi < n_hi) {
+				const Vector origin = (Eigen::Array3f(x, o_hi + 1, z) * h.array() + lo.array()).matrix();
+				impl::sample_row(f, origin, step, n_hi - o_hi, &values[n_offset + (o_hi + 1 - n_lo)]);
+			}
+			offset[col] = n_offset;
+			v_lo[col] = n_lo;
+			v_hi[col] = n_hi;
+
+			//Find the extent of the crossings, and check that there is one
+			int first = g1, last = g0 - 1, prev = -1;
+			bool simple = true;
+			for(int j=0; j<count; ++j) {
+				const int c = impl::sample_class(values[offset[col] + j]);
+				if(j > 0 && c != prev) {
+					first = std::min(first, v_lo[col] + j - 1);
+					last = v_lo[col] + j - 1;
+				}
+				simple = simple && (j == 0 || c >= prev);
+				prev = c;
+			}
+
+			//A column crossing more than once is sampled completely
+			if(!full[col] && !simple) {
+				full[col] = 1;
+				if(n_lo > g0 || n_hi < g1) {
+					t_lo[col] = g1 + 1;
+					t_hi[col] = g0 - 1;
+					changed = true;
+					continue;
+				}
+			}
+
+			if(full[col]) {
+				//Ends on the wrong side of the surface cross it past the ends of the grid
+				if(impl::sample_class(values[offset[col]]) != -1) {
+					first = g0 - 1;
+					last = std::max(last, first);
+				}
+				if(prev != 1) {
+					last = g1;
+					first = std::min(first, last);
+				}
+				t_lo[col] = first;
+				t_hi[col] = last;
+				changed = true;
+			}
+		}
+	}
+
+	//Find edge intersections, restricted to those which sweep_edges would visit
+	for(int z=0; z<res[2]; ++z)
+	for(int x=0; x<res[0]; ++x) {
+		const int col = z * nx + x;
+		const int x_col = col + 1, z_col = col + nx;
+		const int c_base = offset[col] - v_lo[col];
+		const int x_base = offset[x_col] - v_lo[x_col];
+		const int z_base = offset[z_col] - v_lo[z_col];
+
+		for(int y=s_lo[col]; y<=std::min(s_hi[col], res[1]-1); ++y) {
+			const Eigen::Vector3i coord(x, y, z);
+			const Vector p = (coord.cast<float>().array() * h.array() + lo.array()).matrix();
+			const float c_f = values[c_base + y];
+
+			if(y >= s_lo[x_col] && y <= s_hi[x_col])
+				cells.add_edge(coord, 0, p, h[0], c_f, values[x_base + y]);
+			if(y+1 <= s_hi[col])
+				cells.add_edge(coord, 1, p, h[1], c_f, values[c_base + y + 1]);
+			if(y >= s_lo[z_col] && y <= s_hi[z_col])
+				cells.add_edge(coord, 2, p, h[2], c_f, values[z_base + y]);
+		}
+	}
+
+	cells.extract(mesh, attr, res);
+}
+
+};
+
+#endif
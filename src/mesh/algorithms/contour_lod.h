@@ -0,0 +1,274 @@
+#ifndef MESH_CONTOUR_LOD_H
+#define MESH_CONTOUR_LOD_H
+
+#include <cassert>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+#include "mesh/core/trimesh.h"
+#include "mesh/algorithms/density.h"
+#include "mesh/algorithms/contour.h"
+
+namespace Mesh {
+namespace impl {
+
+	inline int floor_div(int a, int b) {
+		return a >= 0 ? a / b : -((-a + b - 1) / b);
+	}
+
+	///Cell of a level of detail grid, named by level and lattice coordinate
+	struct LODCell {
+		int				level;
+		Eigen::Vector3i	coord;
+	};
+
+	///Face dual to a minimal crossing edge along axis
+	struct LODQuad {
+		LODCell			cells[4];
+		Eigen::Vector4f	crossing;
+		int				axis;
+	};
+
+	///Sums of the finer crossings around a cell without crossings of its own
+	struct LODPending {
+		LODPending() :
+			position(0, 0, 0),
+			slope(0, 0, 0),
+			count(0),
+			slope_count(0, 0, 0) {}
+
+		Eigen::Vector3f	position, slope;
+		int				count;
+		Eigen::Vector3i	slope_count;
+	};
+};
+
+/**
+ * Contours f over a set of chunks with different levels of detail.
+ *
+ * Chunk c covers the box [lo + c * chunk_size, lo + (c+1) * chunk_size].  A
+ * chunk at level L is sampled with res >> L cells along each axis, so every
+ * level halves the resolution.  Each chunk is contoured like isocontour, and
+ * the seams between chunks are stitched as in octree dual contouring:  the
+ * face dual to a crossing edge is generated only from the finest cells around
+ * it, and connects to the vertices of whichever (possibly coarser) cells
+ * contain its neighborhood in the other chunks.  The output is therefore
+ * closed across any combination of levels, without transition cells.
+ *
+ * Faces next to a box which is not in chunks are omitted, leaving the surface
+ * open on the boundary of the chunk set.
+ *
+ * If f implements bounds, chunks which f is safely positive or negative on
+ * are skipped without being sampled.
+ *
+ *  chunks is a list of (chunk coordinate, level) pairs.  res must be a
+ *    multiple of 2^level for every level used.
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename AttributeFunc,
+	typename Vector>
+void isocontour_lod(
+	Mesh& mesh,
+	DensityFunc& f,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector chunk_size,
+	int res,
+	std::vector< std::pair<Eigen::Vector3i, int> > const& chunks) {
+
+	//Chunk levels
+	typename impl::SpatialGrid<int>::type chunk_level;
+	int max_level = 0;
+	for(int i=0; i<(int)chunks.size(); ++i) {
+		assert(chunks[i].second >= 0 && (res >> chunks[i].second) << chunks[i].second == res);
+		chunk_level[chunks[i].first] = chunks[i].second;
+		max_level = std::max(max_level, chunks[i].second);
+	}
+
+	//Crossings and cell vertices per level, named by lattice coordinates
+	std::vector<impl::ContourCells> levels(max_level + 1);
+	const Vector h = (chunk_size.array() / (float)res).matrix();
+
+	//Sample chunks
+	std::vector<float> values;
+	for(int i=0; i<(int)chunks.size(); ++i) {
+		const int L = chunks[i].second;
+		const int n = res >> L, nb = n + 1;
+		const Eigen::Vector3i base = chunks[i].first * n;
+		const Vector h_L = h * (float)(1 << L);
+		impl::ContourCells& cells = levels[L];
+
+		//Chunks which the bounds of f exclude have no crossings
+		const Vector c_lo = (base.cast<float>().array() * h_L.array() + lo.array()).matrix();
+		const Vector c_hi = ((base.array() + n).cast<float>() * h_L.array() + lo.array()).matrix();
+		if(!impl::may_cross(f, c_lo, c_hi))
+			continue;
+
+		values.resize(nb * nb * nb);
+		const Eigen::Vector3f step(0, h_L[1], 0);
+		for(int z=0; z<nb; ++z)
+		for(int x=0; x<nb; ++x) {
+			const Vector origin = ((base + Eigen::Vector3i(x, 0, z)).cast<float>().array() * h_L.array() + lo.array()).matrix();
+			impl::sample_row(f, origin, step, nb, &values[(z * nb + x) * nb]);
+		}
+
+		//Find edge intersections
+		const int stride[3] = { nb, 1, nb * nb };
+		for(int z=0; z<nb; ++z)
+		for(int x=0; x<nb; ++x)
+		for(int y=0; y<nb; ++y) {
+			const Eigen::Vector3i local(x, y, z);
+			const Eigen::Vector3i coord = base + local;
+			const Vector p = (coord.cast<float>().array() * h_L.array() + lo.array()).matrix();
+			const int idx = (z * nb + x) * nb + y;
+			for(int e=0; e<3; ++e) {
+				if(local[e] >= n)
+					continue;
+				Eigen::Vector4f crossing;
+				if(impl::edge_crossing(e, p, h_L[e], values[idx], values[idx + stride[e]], crossing)) {
+					cells.edges[e][coord] = crossing;
+				}
+			}
+		}
+	}
+
+	//Place a vertex in every cell with a crossing
+	for(int i=0; i<(int)chunks.size(); ++i) {
+		const int L = chunks[i].second;
+		const int n = res >> L;
+		const Eigen::Vector3i base = chunks[i].first * n;
+		impl::ContourCells& cells = levels[L];
+
+		for(int z=0; z<n; ++z)
+		for(int x=0; x<n; ++x)
+		for(int y=0; y<n; ++y) {
+			const Eigen::Vector3i coord = base + Eigen::Vector3i(x, y, z);
+			Eigen::Vector3f center, gradient;
+			if(cells.cell_center(coord, center, gradient)) {
+				cells.vertices[coord] = mesh.add_vertex(impl::make_vertex(attr, center, gradient));
+			}
+		}
+	}
+
+	//Collect the faces of the minimal crossing edges
+	std::vector<impl::LODQuad, Eigen::aligned_allocator<impl::LODQuad> > quads;
+	for(int i=0; i<(int)chunks.size(); ++i) {
+		const Eigen::Vector3i chunk = chunks[i].first;
+		const int L = chunks[i].second;
+		const int n = res >> L;
+		const Eigen::Vector3i base = chunk * n;
+		impl::ContourCells& cells = levels[L];
+
+		for(int e=0; e<3; ++e) {
+			const int u_dir = (e+1) % 3;
+			const int v_dir = (e+2) % 3;
+
+			for(int z=0; z<=n; ++z)
+			for(int x=0; x<=n; ++x)
+			for(int y=0; y<=n; ++y) {
+				const Eigen::Vector3i local(x, y, z);
+				if(local[e] >= n)
+					continue;
+				auto iter = cells.edges[e].find(base + local);
+				if(iter == cells.edges[e].end())
+					continue;
+
+				//Find the cells around the edge, from the fine cells next to its start
+				impl::LODQuad quad;
+				quad.crossing = iter->second;
+				quad.axis = e;
+				int owner = -1, k = 0;
+				bool minimal = true;
+				for(int u=0; u<=1 && minimal; ++u)
+				for(int v=0; v<=1 && minimal; ++v, ++k) {
+					Eigen::Vector3i q = iter->first * (1 << L);
+					q[u_dir] -= u;
+					q[v_dir] -= v;
+
+					Eigen::Vector3i q_chunk;
+					for(int j=0; j<3; ++j)
+						q_chunk[j] = impl::floor_div(q[j], res);
+					auto c_iter = chunk_level.find(q_chunk);
+					if(c_iter == chunk_level.end() || c_iter->second < L) {
+						minimal = false;
+						break;
+					}
+
+					const int q_level = c_iter->second;
+					quad.cells[k].level = q_level;
+					for(int j=0; j<3; ++j)
+						quad.cells[k].coord[j] = impl::floor_div(q[j], 1 << q_level);
+
+					//Shared edges are generated by the first finest chunk around them
+					if(owner < 0 && q_level == L) {
+						owner = (q_chunk == chunk) ? 1 : 0;
+					}
+				}
+
+				if(minimal && owner == 1) {
+					quads.push_back(quad);
+				}
+			}
+		}
+	}
+
+	//Cells which are only crossed at a finer level get the average of those crossings
+	std::vector<typename impl::SpatialGrid<impl::LODPending>::type> pending(max_level + 1);
+	for(int i=0; i<(int)quads.size(); ++i) {
+		for(int k=0; k<4; ++k) {
+			impl::LODCell const& cell = quads[i].cells[k];
+			if(levels[cell.level].vertices.count(cell.coord))
+				continue;
+			impl::LODPending& sum = pending[cell.level][cell.coord];
+			sum.position += quads[i].crossing.template head<3>();
+			sum.count += 1;
+			sum.slope[quads[i].axis] += quads[i].crossing[3];
+			sum.slope_count[quads[i].axis] += 1;
+		}
+	}
+	for(int L=0; L<=max_level; ++L) {
+		for(auto iter=pending[L].begin(); iter!=pending[L].end(); ++iter) {
+			impl::LODPending const& sum = iter->second;
+			Eigen::Vector3f gradient(0, 0, 0);
+			for(int j=0; j<3; ++j) {
+				if(sum.slope_count[j] > 0)
+					gradient[j] = sum.slope[j] / (float)sum.slope_count[j];
+			}
+			levels[L].vertices[iter->first] = mesh.add_vertex(impl::make_vertex(
+				attr, (sum.position / (float)sum.count).eval(), gradient));
+		}
+	}
+
+	//Generate faces, dropping triangles which collapse onto a coarse cell
+	for(int i=0; i<(int)quads.size(); ++i) {
+		int vert[4];
+		for(int k=0; k<4; ++k) {
+			vert[k] = levels[quads[i].cells[k].level].vertices[quads[i].cells[k].coord];
+		}
+
+		int tris[2][3];
+		if(quads[i].crossing[3] < 0) {
+			tris[0][0] = vert[0]; tris[0][1] = vert[1]; tris[0][2] = vert[2];
+			tris[1][0] = vert[2]; tris[1][1] = vert[1]; tris[1][2] = vert[3];
+		}
+		else {
+			tris[0][0] = vert[0]; tris[0][1] = vert[2]; tris[0][2] = vert[1];
+			tris[1][0] = vert[1]; tris[1][1] = vert[2]; tris[1][2] = vert[3];
+		}
+		for(int t=0; t<2; ++t) {
+			if(tris[t][0] == tris[t][1] || tris[t][1] == tris[t][2] || tris[t][2] == tris[t][0])
+				continue;
+			mesh.add_triangle(tris[t][0], tris[t][1], tris[t][2]);
+		}
+	}
+}
+
+};
+
+#endif
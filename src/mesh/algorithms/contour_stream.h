@@ -0,0 +1,311 @@
+#ifndef MESH_CONTOUR_STREAM_H
+#define MESH_CONTOUR_STREAM_H
+
+#include <cassert>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+#include "mesh/core/triangle.h"
+#include "mesh/core/trimesh.h"
+#include "mesh/algorithms/density.h"
+#include "mesh/algorithms/contour.h"
+
+namespace Mesh {
+
+/**
+ * Streaming output conventions.
+ *
+ * A sink receives the output of a streaming algorithm in batches through
+ *
+ *	void vertices(VertexData const* data, int count);
+ *	void triangles(Triangle const* data, int count);
+ *
+ * Vertices are named by the order they are emitted, starting from 0, and every
+ * vertex is emitted in an earlier or the same batch as the first triangle
+ * which refers to it.  Vertices are always delivered before the triangles of
+ * the same batch, so a sink may write both straight to a file or socket.
+ */
+
+/**
+ * Sink which appends the streamed output to a TriMesh.
+ */
+template<typename Mesh>
+struct MeshSink {
+	MeshSink(Mesh& mesh_) : mesh(mesh_) {}
+
+	void vertices(typename Mesh::VertexData const* data, int count) {
+		for(int i=0; i<count; ++i) {
+			names.push_back(mesh.add_vertex(data[i]));
+		}
+	}
+
+	void triangles(Triangle const* data, int count) {
+		for(int i=0; i<count; ++i) {
+			mesh.add_triangle(names[data[i].v[0]], names[data[i].v[1]], names[data[i].v[2]]);
+		}
+	}
+
+private:
+	Mesh&				mesh;
+	std::vector<int>	names;
+};
+
+namespace impl {
+
+	///Cell of the streaming contour, vertex is -2 for empty, -1 if not yet emitted
+	struct StreamCell {
+		Eigen::Vector3f	position, gradient;
+		int				vertex;
+	};
+
+	///Reads the slabs of a grid for contour_slabs by sampling a density
+	template<typename DensityFunc>
+	struct DensitySlabs {
+		DensitySlabs(
+			DensityFunc& f_,
+			Eigen::Vector3f const& lo_,
+			Eigen::Vector3f const& h_,
+			int nx_,
+			int ny_) :
+			f(f_),
+			lo(lo_),
+			h(h_),
+			nx(nx_),
+			ny(ny_) {}
+
+		void operator()(int z, float* out) {
+			sample_slab(f, lo, h, z, nx, ny, out);
+		}
+
+		DensityFunc&	f;
+		Eigen::Vector3f	lo, h;
+		int				nx, ny;
+	};
+
+	/**
+	 * Sweep of isocontour_stream over a grid of res cells of size h from lo,
+	 * whose samples are read in order of increasing z by slabs(z, out), which
+	 * writes the (res[0] + 1) * (res[1] + 1) samples of slab z as rows along y.
+	 * The faces of the cells on the border of the grid are not generated.
+	 */
+	template<
+		typename Sink,
+		typename SlabFunc,
+		typename AttributeFunc,
+		typename Vector>
+	void contour_slabs(
+		Sink& sink,
+		SlabFunc& slabs,
+		AttributeFunc& attr,
+		Vector const& lo,
+		Vector const& h,
+		Eigen::Vector3i const& res) {
+
+		typedef typename std::decay<decltype(make_vertex(attr, std::declval<Eigen::Vector3f>(), std::declval<Eigen::Vector3f>()))>::type VertexData;
+
+		const int nx = res[0] + 1, ny = res[1] + 1, slab = nx * ny;
+
+		//Slab samples
+		float* above = new float[slab];
+		float* below = new float[slab];
+		ScopedArray<float> aguard(above), bguard(below);
+
+		//Crossings of the x/y edges in the lower/upper layer and of the z edges
+		//between them, w = 0 when the edge does not cross
+		Eigen::Vector4f* crossing_buffer = new Eigen::Vector4f[5 * slab];
+		ScopedArray<Eigen::Vector4f> crossing_guard(crossing_buffer);
+		std::fill(crossing_buffer, crossing_buffer + 5 * slab, Eigen::Vector4f(0, 0, 0, 0));
+		Eigen::Vector4f* layer_edges[2][2] = {
+			{ crossing_buffer,				crossing_buffer + slab },
+			{ crossing_buffer + 2 * slab,	crossing_buffer + 3 * slab } };
+		Eigen::Vector4f* z_edges = crossing_buffer + 4 * slab;
+
+		//Cells in the previous and current layer
+		StreamCell* cell_buffer = new StreamCell[2 * slab];
+		ScopedArray<StreamCell> cell_guard(cell_buffer);
+		StreamCell* cells[2] = { cell_buffer, cell_buffer + slab };
+		for(int i=0; i<2*slab; ++i)
+			cell_buffer[i].vertex = -2;
+
+		//Output batch
+		std::vector<VertexData> out_vertices;
+		std::vector<Triangle> out_triangles;
+		int vertex_count = 0;
+
+		slabs(0, below);
+
+		for(int z=0; z<res[2]; ++z) {
+			slabs(z+1, above);
+
+			//Compute edge intersections, following the edge set of sweep_edges
+			for(int x=0; x<res[0]; ++x)
+			for(int y=0; y<res[1]; ++y) {
+				const int idx = x * ny + y;
+				const Eigen::Vector3f p = (Eigen::Array3f(x, y, z) * h.array() + lo.array()).matrix();
+				const Eigen::Vector3f p_up = (Eigen::Array3f(x, y, z+1) * h.array() + lo.array()).matrix();
+
+				if(z == 0) {
+					edge_crossing(0, p, h[0], below[idx], below[idx+ny], layer_edges[0][0][idx]);
+					edge_crossing(1, p, h[1], below[idx], below[idx+1], layer_edges[0][1][idx]);
+				}
+				edge_crossing(2, p, h[2], below[idx], above[idx], z_edges[idx]);
+				if(z+1 < res[2]) {
+					edge_crossing(0, p_up, h[0], above[idx], above[idx+ny], layer_edges[1][0][idx]);
+					edge_crossing(1, p_up, h[1], above[idx], above[idx+1], layer_edges[1][1][idx]);
+				}
+			}
+
+			//Place the vertices of the cells in layer z at the average of their crossings
+			for(int x=0; x<res[0]; ++x)
+			for(int y=0; y<res[1]; ++y) {
+				int n = 0, n_e[3] = { 0, 0, 0 };
+				Eigen::Vector4f center(0, 0, 0, 0);
+				Eigen::Vector3f gradient(0, 0, 0);
+
+				for(int e=0; e<3; ++e)
+				for(int u=0; u<=1; ++u)
+				for(int v=0; v<=1; ++v) {
+					Eigen::Vector4f const* crossing;
+					if(e == 0) {
+						crossing = &layer_edges[v][0][x * ny + y + u];
+					}
+					else if(e == 1) {
+						crossing = &layer_edges[u][1][(x + v) * ny + y];
+					}
+					else {
+						crossing = &z_edges[(x + u) * ny + y + v];
+					}
+					if((*crossing)[3] == 0)
+						continue;
+					center += *crossing;
+					gradient[e] += (*crossing)[3];
+					++n;
+					++n_e[e];
+				}
+
+				StreamCell& cell = cells[1][x * ny + y];
+				if(n == 0) {
+					cell.vertex = -2;
+					continue;
+				}
+				center /= (float)n;
+				for(int e=0; e<3; ++e) {
+					if(n_e[e] > 0)
+						gradient[e] /= (float)n_e[e];
+				}
+				cell.position = Eigen::Vector3f(center[0], center[1], center[2]);
+				cell.gradient = gradient;
+				cell.vertex = -1;
+			}
+
+			//Generate the faces dual to the crossings in layer z
+			for(int e=0; e<3; ++e) {
+				const int u_dir = (e+1) % 3;
+				const int v_dir = (e+2) % 3;
+
+				for(int x=0; x<res[0]; ++x)
+				for(int y=0; y<res[1]; ++y) {
+					const Eigen::Vector3i coord(x, y, z);
+					const int idx = x * ny + y;
+					Eigen::Vector4f const& crossing = (e == 2) ? z_edges[idx] : layer_edges[0][e][idx];
+					if(crossing[3] == 0)
+						continue;
+
+					if(	coord[u_dir] <= 0 || coord[v_dir] <= 0 ||
+						coord[u_dir] >= res[u_dir]-1 ||
+						coord[v_dir] >= res[v_dir]-1 ||
+						coord[e] >= res[e] - 2)
+						continue;
+
+					int vert[4], n=0;
+					for(int u=0; u<=1; ++u)
+					for(int v=0; v<=1; ++v) {
+						Eigen::Vector3i tmp(coord);
+						tmp[u_dir] -= u;
+						tmp[v_dir] -= v;
+
+						StreamCell& cell = cells[tmp[2] - z + 1][tmp[0] * ny + tmp[1]];
+						assert(cell.vertex != -2);
+						if(cell.vertex < 0) {
+							out_vertices.push_back(make_vertex(attr, cell.position, cell.gradient));
+							cell.vertex = vertex_count++;
+						}
+						vert[n++] = cell.vertex;
+					}
+
+					if(crossing[3] < 0) {
+						out_triangles.push_back(Triangle(vert[0], vert[1], vert[2]));
+						out_triangles.push_back(Triangle(vert[2], vert[1], vert[3]));
+					}
+					else {
+						out_triangles.push_back(Triangle(vert[0], vert[2], vert[1]));
+						out_triangles.push_back(Triangle(vert[1], vert[2], vert[3]));
+					}
+				}
+			}
+
+			//Flush batch
+			if(out_vertices.size() > 0)
+				sink.vertices(&out_vertices[0], (int)out_vertices.size());
+			if(out_triangles.size() > 0)
+				sink.triangles(&out_triangles[0], (int)out_triangles.size());
+			out_vertices.clear();
+			out_triangles.clear();
+
+			//Advance a layer
+			std::swap(above, below);
+			std::swap(layer_edges[0][0], layer_edges[1][0]);
+			std::swap(layer_edges[0][1], layer_edges[1][1]);
+			std::fill(layer_edges[1][0], layer_edges[1][0] + slab, Eigen::Vector4f(0, 0, 0, 0));
+			std::fill(layer_edges[1][1], layer_edges[1][1] + slab, Eigen::Vector4f(0, 0, 0, 0));
+			std::fill(z_edges, z_edges + slab, Eigen::Vector4f(0, 0, 0, 0));
+			std::swap(cells[0], cells[1]);
+		}
+	}
+};
+
+/**
+ * Streaming version of isocontour.
+ *
+ * Produces the same surface as isocontour(mesh, f, attr, lo, hi, res), but
+ * writes it to sink one z slab at a time instead of building a mesh.  Only a
+ * few slabs of samples, crossings and cells are kept, so memory use is
+ * O(res[0] * res[1]) regardless of the size of the output.  Unlike isocontour,
+ * cell vertices which are not used by any triangle are not emitted.
+ *
+ *  Sink implements the sink interface above (see MeshSink)
+ *  DensityFunc is a lambda of type Eigen::Vector3f -> float, optionally with
+ *    a batched row evaluator (see mesh/algorithms/density.h)
+ *  AttributeFunc is a lambda of type Eigen::Vector3f -> VertexData
+ */
+template<
+	typename Sink,
+	typename DensityFunc,
+	typename AttributeFunc,
+	typename Vector>
+void isocontour_stream(
+	Sink& sink,
+	DensityFunc& f,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector hi,
+	Eigen::Vector3i res) {
+
+	//Grid size
+	const Vector h = ((hi - lo).array() / Vector(res[0], res[1], res[2]).array()).matrix();
+	lo -= h;
+	for(int i=0; i<3; ++i)
+		res[i] += 2;
+
+	impl::DensitySlabs<DensityFunc> slabs(f, lo, h, res[0] + 1, res[1] + 1);
+	impl::contour_slabs(sink, slabs, attr, lo, h, res);
+}
+
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef MESH_DENSITY_H
+#define MESH_DENSITY_H
+
+#include <cstdlib>
+#include <utility>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+
+namespace Mesh {
+
+/**
+ * Density function conventions used by the contouring algorithms.
+ *
+ * The basic density is a lambda of type Eigen::Vector3f -> float.  A density
+ * may additionally implement a batched row evaluator:
+ *
+ *	void operator()(
+ *		Eigen::Vector3f const& origin,
+ *		Eigen::Vector3f const& step,
+ *		int count,
+ *		float* out);
+ *
+ * which must write f(origin + i * step) to out[i] for 0 <= i < count.  When
+ * it is present the contouring code samples whole rows at a time through it,
+ * which lets the density amortize setup costs and vectorize its inner loop.
+ * Otherwise the per point form is used.
+ *
+ * The adaptive contouring code also takes a bound on the density, which is a
+ * lambda of type (Eigen::Vector3f lo, Eigen::Vector3f hi) -> Eigen::Vector2f
+ * returning an interval [min,max] which contains f(p) for every p in the
+ * closed box [lo,hi].  The bound only needs to be conservative, not tight.
+ *
+ * A density may also bound itself by implementing
+ *
+ *	Eigen::Vector2f bounds(
+ *		Eigen::Vector3f const& lo,
+ *		Eigen::Vector3f const& hi);
+ *
+ * with the same meaning.  isocontour and isocontour_lod then skip the blocks
+ * and chunks whose bounds exclude 0 without sampling them, and DensityBounds
+ * passes it to the adaptive contouring code.
+ *
+ * Attribute functions are lambdas of type Eigen::Vector3f -> VertexData.  An
+ * attribute function may additionally implement
+ *
+ *	VertexData operator()(
+ *		Eigen::Vector3f const& position,
+ *		Eigen::Vector3f const& gradient);
+ *
+ * which the contouring code calls instead, with an estimate of the gradient
+ * of the density at the vertex computed from the samples it already took.
+ * This lets normals be computed without evaluating the density again.
+ */
+
+/**
+ * Bounds a density with a known Lipschitz constant, ie.
+ * |f(p) - f(q)| <= lipschitz * |p - q|, from a single sample at the center of
+ * the box.
+ */
+template<typename DensityFunc>
+struct LipschitzBound {
+	LipschitzBound(DensityFunc& f_, float lipschitz_) : f(f_), lipschitz(lipschitz_) {}
+
+	Eigen::Vector2f operator()(Eigen::Vector3f const& lo, Eigen::Vector3f const& hi) {
+		const float c = f(((lo + hi) * 0.5f).eval());
+		const float r = 0.5f * lipschitz * (hi - lo).norm();
+		return Eigen::Vector2f(c - r, c + r);
+	}
+
+private:
+	DensityFunc& f;
+	float lipschitz;
+};
+
+/**
+ * Bound which calls the bounds member of a density.
+ */
+template<typename DensityFunc>
+struct DensityBounds {
+	DensityBounds(DensityFunc& f_) : f(f_) {}
+
+	Eigen::Vector2f operator()(Eigen::Vector3f const& lo, Eigen::Vector3f const& hi) {
+		return f.bounds(lo, hi);
+	}
+
+private:
+	DensityFunc& f;
+};
+
+/**
+ * Estimates the gradient of a density by central differences with step delta.
+ * Costs 6 evaluations of f per call.
+ */
+template<typename DensityFunc>
+struct CentralDifference {
+	CentralDifference(DensityFunc& f_, float delta_) : f(f_), delta(delta_) {}
+
+	Eigen::Vector3f operator()(Eigen::Vector3f const& p) {
+		Eigen::Vector3f result;
+		for(int i=0; i<3; ++i) {
+			Eigen::Vector3f dp(0, 0, 0);
+			dp[i] = delta;
+			result[i] = (f((p + dp).eval()) - f((p - dp).eval())) / (2.f * delta);
+		}
+		return result;
+	}
+
+private:
+	DensityFunc& f;
+	float delta;
+};
+
+namespace impl {
+
+	/// Detects whether DensityFunc implements the batched row evaluator
+	template<typename DensityFunc>
+	struct has_batch_density {
+		template<typename F> static char test(
+			decltype(std::declval<F&>()(
+				std::declval<Eigen::Vector3f const&>(),
+				std::declval<Eigen::Vector3f const&>(),
+				0,
+				(float*)NULL))*);
+		template<typename F> static long test(...);
+
+		enum { value = sizeof(test<DensityFunc>(NULL)) == sizeof(char) };
+	};
+
+	/// Detects whether DensityFunc implements bounds
+	template<typename DensityFunc>
+	struct has_density_bounds {
+		template<typename F> static char test(
+			decltype(std::declval<F&>().bounds(
+				std::declval<Eigen::Vector3f const&>(),
+				std::declval<Eigen::Vector3f const&>()))*);
+		template<typename F> static long test(...);
+
+		enum { value = sizeof(test<DensityFunc>(NULL)) == sizeof(char) };
+	};
+
+	/// Detects whether AttributeFunc accepts a gradient
+	template<typename AttributeFunc>
+	struct has_gradient_attribute {
+		template<typename F> static char test(
+			decltype(std::declval<F&>()(
+				std::declval<Eigen::Vector3f const&>(),
+				std::declval<Eigen::Vector3f const&>()))*);
+		template<typename F> static long test(...);
+
+		enum { value = sizeof(test<AttributeFunc>(NULL)) == sizeof(char) };
+	};
+
+	template<bool with_gradient> struct VertexMaker {
+		template<typename AttributeFunc>
+		static auto run(
+			AttributeFunc& attr,
+			Eigen::Vector3f const& p,
+			Eigen::Vector3f const& gradient) -> decltype(attr(p, gradient)) {
+			return attr(p, gradient);
+		}
+	};
+
+	template<> struct VertexMaker<false> {
+		template<typename AttributeFunc>
+		static auto run(
+			AttributeFunc& attr,
+			Eigen::Vector3f const& p,
+			Eigen::Vector3f const&) -> decltype(attr(p)) {
+			return attr(p);
+		}
+	};
+
+	/**
+	 * Computes the vertex data at p, passing the gradient estimate on to attr
+	 * if it accepts one.
+	 */
+	template<typename AttributeFunc>
+	auto make_vertex(
+		AttributeFunc& attr,
+		Eigen::Vector3f const& p,
+		Eigen::Vector3f const& gradient)
+		-> decltype(VertexMaker<has_gradient_attribute<AttributeFunc>::value>::run(attr, p, gradient)) {
+		return VertexMaker<has_gradient_attribute<AttributeFunc>::value>::run(attr, p, gradient);
+	}
+
+	template<bool batched> struct RowSampler {
+		template<typename DensityFunc>
+		static void run(
+			DensityFunc& f,
+			Eigen::Vector3f const& origin,
+			Eigen::Vector3f const& step,
+			int count,
+			float* out) {
+			f(origin, step, count, out);
+		}
+	};
+
+	template<> struct RowSampler<false> {
+		template<typename DensityFunc>
+		static void run(
+			DensityFunc& f,
+			Eigen::Vector3f const& origin,
+			Eigen::Vector3f const& step,
+			int count,
+			float* out) {
+			for(int i=0; i<count; ++i) {
+				out[i] = f((origin + (float)i * step).eval());
+			}
+		}
+	};
+
+	/**
+	 * Evaluates count samples of f along a row, using the batched form of
+	 * the density when it is available.
+	 */
+	template<typename DensityFunc>
+	void sample_row(
+		DensityFunc& f,
+		Eigen::Vector3f const& origin,
+		Eigen::Vector3f const& step,
+		int count,
+		float* out) {
+		RowSampler<has_batch_density<DensityFunc>::value>::run(f, origin, step, count, out);
+	}
+
+	template<bool bounded> struct BoundsTest {
+		template<typename DensityFunc>
+		static bool run(
+			DensityFunc& f,
+			Eigen::Vector3f const& lo,
+			Eigen::Vector3f const& hi) {
+			const Eigen::Vector2f range = f.bounds(lo, hi);
+			return range[0] <= FP_TOLERANCE && range[1] >= -FP_TOLERANCE;
+		}
+	};
+
+	template<> struct BoundsTest<false> {
+		template<typename DensityFunc>
+		static bool run(
+			DensityFunc&,
+			Eigen::Vector3f const&,
+			Eigen::Vector3f const&) {
+			return true;
+		}
+	};
+
+	/**
+	 * Tests whether the 0-level set of f may pass through the closed box
+	 * [lo,hi], ie. unless the bounds of f show that it is safely positive or
+	 * negative there.  Always true for densities without bounds.
+	 */
+	template<typename DensityFunc>
+	bool may_cross(
+		DensityFunc& f,
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& hi) {
+		return BoundsTest<has_density_bounds<DensityFunc>::value>::run(f, lo, hi);
+	}
+
+	/**
+	 * Samples the z-th slab of the grid lo + (x,y,z) * h into out.  The slab
+	 * is stored with y varying fastest, out[x * ny + y], and is evaluated as
+	 * nx rows of ny samples each.
+	 */
+	template<typename DensityFunc>
+	void sample_slab(
+		DensityFunc& f,
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& h,
+		int z,
+		int nx,
+		int ny,
+		float* out) {
+		const Eigen::Vector3f step(0, h[1], 0);
+		for(int x=0; x<nx; ++x) {
+			const Eigen::Vector3f origin = (Eigen::Array3f(x, 0, z) * h.array() + lo.array()).matrix();
+			sample_row(f, origin, step, ny, out + x * ny);
+		}
+	}
+
+};
+
+};
+
+#endif
+
@@ -0,0 +1,451 @@
+#ifndef MESH_DENSITY_CACHE_H
+#define MESH_DENSITY_CACHE_H
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+#include "mesh/algorithms/density.h"
+
+//Blocks are (1 << DENSITY_CACHE_BLOCK_BITS)^3 samples
+#define DENSITY_CACHE_BLOCK_BITS	3
+#define DENSITY_CACHE_BLOCK_SIZE	(1 << (3 * DENSITY_CACHE_BLOCK_BITS))
+
+//Points within this fraction of the spacing from a lattice point are cached
+#define DENSITY_CACHE_LATTICE_TOLERANCE	1e-3
+
+namespace Mesh {
+namespace impl {
+
+	///Names a block of samples by its coordinate on the lattice of its level
+	struct DensityBlockKey {
+		int32_t	coord[3];
+		int32_t	level;
+
+		bool operator==(DensityBlockKey const& other) const {
+			return	coord[0] == other.coord[0] && coord[1] == other.coord[1] &&
+					coord[2] == other.coord[2] && level == other.level;
+		}
+	};
+
+	struct DensityBlockKeyHash {
+		size_t operator()(DensityBlockKey const& key) const {
+			return ZOrderHash<Eigen::Vector3i>()(Eigen::Vector3i(key.coord[0], key.coord[1], key.coord[2])) * 31 + key.level;
+		}
+	};
+
+	///Samples of a block, NaN for samples which have not been evaluated
+	struct DensityBlock {
+		DensityBlock() {
+			for(int i=0; i<DENSITY_CACHE_BLOCK_SIZE; ++i)
+				values[i] = NAN;
+		}
+		float values[DENSITY_CACHE_BLOCK_SIZE];
+	};
+
+	///Layout of a memory mapped spill file
+	struct DensitySpillHeader {
+		char		magic[8];
+		float		origin[3];
+		float		spacing[3];
+		int32_t		max_level;
+		int32_t		slots;
+	};
+
+	struct DensitySpillSlot {
+		DensityBlockKey	key;
+		int32_t			used;
+		DensityBlock	block;
+	};
+};
+
+/**
+ * Caches the samples of a density on a lattice.
+ *
+ * DensityCache wraps a density and is itself a density (with the batched row
+ * evaluator, and the bounds of f when f has them), so it can be passed to any
+ * of the contouring functions in place of f.  Samples at points of the lattice origin + i * spacing are stored in
+ * blocks and looked up on later calls; other points are passed through to f.
+ * Contouring the same region again, for example at another isovalue, then
+ * costs almost no evaluations of f.
+ *
+ * Each sample is stored at the coarsest level L <= max_level for which its
+ * lattice index is a multiple of 2^L, and blocks are keyed by (block
+ * coordinate, level).  A grid with spacing * 2^L therefore fills whole blocks
+ * of level L, and every sample is shared between all the resolutions which
+ * contain it.
+ *
+ * Blocks are kept in shards, each with its own lock and least recently used
+ * list, so the cache may be used from several threads as long as f can.  At
+ * most max_blocks blocks are kept in memory.  If spill_path is given, evicted
+ * blocks are written to a memory mapped file of spill_blocks slots instead of
+ * being dropped, and read back on a later miss;  once all the slots are used,
+ * new blocks replace the spilled ones in turn.  The blocks still in memory
+ * are written to it by flush() and on destruction, and the file is reused by
+ * later caches with the same lattice, so it also persists samples between
+ * runs; it is the caller's responsibility that f has not changed in between.
+ *
+ * To be useful for isocontour(f, lo, hi, res), use origin = lo and
+ * spacing = (hi - lo) / res (or a power of two fraction of it).
+ */
+template<typename DensityFunc>
+struct DensityCache {
+
+	DensityCache(
+		DensityFunc& f_,
+		Eigen::Vector3f const& origin_,
+		Eigen::Vector3f const& spacing_,
+		int max_blocks = 4096,
+		int num_shards = 16,
+		const char* spill_path = NULL,
+		int spill_blocks = 0,
+		int max_level_ = 4) :
+		f(f_),
+		origin(origin_),
+		spacing(spacing_),
+		max_level(max_level_),
+		shard_capacity(std::max(1, max_blocks / num_shards)),
+		shard_count(num_shards),
+		shards(new Shard[num_shards]),
+		spill_fd(-1),
+		spill_size(0),
+		spill_header(NULL),
+		spill_slots(NULL),
+		spill_used(0),
+		spill_next(0),
+		evaluation_count(0) {
+
+		if(spill_path && spill_blocks > 0)
+			open_spill(spill_path, spill_blocks);
+	}
+
+	~DensityCache() {
+		flush();
+		if(spill_header) {
+			munmap(spill_header, spill_size);
+		}
+		if(spill_fd >= 0) {
+			close(spill_fd);
+		}
+	}
+
+	float operator()(Eigen::Vector3f const& p) {
+		impl::DensityBlockKey key;
+		int offset;
+		if(!locate(p, key, offset)) {
+			++evaluation_count;
+			return f(p);
+		}
+
+		Shard& shard = shard_of(key);
+		{
+			std::lock_guard<std::mutex> guard(shard.lock);
+			const float v = fetch(shard, key)->values[offset];
+			if(v == v)
+				return v;
+		}
+
+		const float v = f(p);
+		++evaluation_count;
+
+		std::lock_guard<std::mutex> guard(shard.lock);
+		fetch(shard, key)->values[offset] = v;
+		return v;
+	}
+
+	void operator()(
+		Eigen::Vector3f const& row_origin,
+		Eigen::Vector3f const& step,
+		int count,
+		float* out) {
+
+		std::vector<impl::DensityBlockKey> keys(count);
+		std::vector<int> offsets(count);
+		for(int i=0; i<count; ++i) {
+			if(!locate((row_origin + (float)i * step).eval(), keys[i], offsets[i]))
+				offsets[i] = -1;
+		}
+
+		//Read cached samples, one lock per run of points in the same block
+		for(int i=0; i<count; ) {
+			if(offsets[i] < 0) {
+				out[i++] = NAN;
+				continue;
+			}
+			Shard& shard = shard_of(keys[i]);
+			std::lock_guard<std::mutex> guard(shard.lock);
+			impl::DensityBlock* block = fetch(shard, keys[i]);
+			const impl::DensityBlockKey key = keys[i];
+			for(; i<count && offsets[i] >= 0 && keys[i] == key; ++i) {
+				out[i] = block->values[offsets[i]];
+			}
+		}
+
+		//Evaluate runs of missing samples through f
+		bool any_missing = false;
+		for(int i=0; i<count; ) {
+			if(out[i] == out[i]) {
+				++i;
+				continue;
+			}
+			int j = i + 1;
+			while(j < count && out[j] != out[j])
+				++j;
+			impl::sample_row(f, (row_origin + (float)i * step).eval(), step, j - i, out + i);
+			evaluation_count += j - i;
+			any_missing = true;
+			i = j;
+		}
+		if(!any_missing)
+			return;
+
+		//Write back
+		for(int i=0; i<count; ) {
+			if(offsets[i] < 0) {
+				++i;
+				continue;
+			}
+			Shard& shard = shard_of(keys[i]);
+			std::lock_guard<std::mutex> guard(shard.lock);
+			impl::DensityBlock* block = fetch(shard, keys[i]);
+			const impl::DensityBlockKey key = keys[i];
+			for(; i<count && offsets[i] >= 0 && keys[i] == key; ++i) {
+				block->values[offsets[i]] = out[i];
+			}
+		}
+	}
+
+	///Range [min,max] containing f on the closed box [lo,hi], if f implements bounds
+	template<typename F = DensityFunc>
+	auto bounds(
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& hi) -> decltype(std::declval<F&>().bounds(lo, hi)) {
+		return f.bounds(lo, hi);
+	}
+
+	///Total number of evaluations of f so far
+	long evaluations() const {
+		return evaluation_count;
+	}
+
+	///Writes the blocks in memory to the spill file, if any, keeping them cached
+	void flush() {
+		if(!spill_slots)
+			return;
+		for(int i=0; i<shard_count; ++i) {
+			std::lock_guard<std::mutex> guard(shards.ptr[i].lock);
+			for(auto iter = shards.ptr[i].blocks.begin(); iter != shards.ptr[i].blocks.end(); ++iter)
+				spill(iter->first, *iter->second.block);
+		}
+	}
+
+	///Drops all cached samples, including the spilled ones
+	void clear() {
+		for(int i=0; i<shard_count; ++i) {
+			std::lock_guard<std::mutex> guard(shards.ptr[i].lock);
+			shards.ptr[i].blocks.clear();
+			shards.ptr[i].lru.clear();
+		}
+		std::lock_guard<std::mutex> guard(spill_lock);
+		spill_index.clear();
+		for(int i=0; i<spill_used; ++i)
+			spill_slots[i].used = 0;
+		spill_used = 0;
+		spill_next = 0;
+	}
+
+private:
+	typedef std::list<impl::DensityBlockKey> LRUList;
+
+	struct Entry {
+		std::unique_ptr<impl::DensityBlock>	block;
+		typename LRUList::iterator			position;
+	};
+
+	struct Shard {
+		std::mutex	lock;
+		LRUList		lru;
+		std::unordered_map<impl::DensityBlockKey, Entry, impl::DensityBlockKeyHash> blocks;
+	};
+
+	///Finds the block and offset of the lattice point p, or returns false if p is off the lattice
+	bool locate(
+		Eigen::Vector3f const& p,
+		impl::DensityBlockKey& key,
+		int& offset) const {
+
+		int index[3];
+		for(int i=0; i<3; ++i) {
+			const float t = (p[i] - origin[i]) / spacing[i];
+			const float r = std::floor(t + 0.5f);
+			if(std::abs(t - r) > DENSITY_CACHE_LATTICE_TOLERANCE)
+				return false;
+			index[i] = (int)r;
+		}
+
+		//Coarsest level containing the point
+		int level = 0;
+		while(level < max_level &&
+			!((index[0] | index[1] | index[2]) & (1 << level)))
+			++level;
+
+		const int mask = (1 << DENSITY_CACHE_BLOCK_BITS) - 1;
+		offset = 0;
+		for(int i=0; i<3; ++i) {
+			const int l = index[i] >> level;
+			key.coord[i] = l >> DENSITY_CACHE_BLOCK_BITS;
+			offset = (offset << DENSITY_CACHE_BLOCK_BITS) | (l & mask);
+		}
+		key.level = level;
+		return true;
+	}
+
+	Shard& shard_of(impl::DensityBlockKey const& key) {
+		return shards.ptr[impl::DensityBlockKeyHash()(key) % shard_count];
+	}
+
+	///Returns the block for key, creating it if necessary.  Shard must be locked.
+	impl::DensityBlock* fetch(Shard& shard, impl::DensityBlockKey const& key) {
+		auto iter = shard.blocks.find(key);
+		if(iter != shard.blocks.end()) {
+			shard.lru.splice(shard.lru.begin(), shard.lru, iter->second.position);
+			return iter->second.block.get();
+		}
+
+		//Evict the least recently used block
+		if((int)shard.blocks.size() >= shard_capacity) {
+			auto victim = shard.blocks.find(shard.lru.back());
+			spill(victim->first, *victim->second.block);
+			shard.blocks.erase(victim);
+			shard.lru.pop_back();
+		}
+
+		shard.lru.push_front(key);
+		Entry& entry = shard.blocks[key];
+		entry.block.reset(new impl::DensityBlock());
+		entry.position = shard.lru.begin();
+		unspill(key, *entry.block);
+		return entry.block.get();
+	}
+
+	void open_spill(const char* path, int slots) {
+		spill_size = sizeof(impl::DensitySpillHeader) + slots * sizeof(impl::DensitySpillSlot);
+		spill_fd = open(path, O_RDWR | O_CREAT, 0644);
+		if(spill_fd < 0)
+			return;
+
+		struct stat info;
+		const bool existing = fstat(spill_fd, &info) == 0 && (size_t)info.st_size == spill_size;
+		if(!existing && ftruncate(spill_fd, spill_size) != 0) {
+			close(spill_fd);
+			spill_fd = -1;
+			return;
+		}
+
+		void* ptr = mmap(NULL, spill_size, PROT_READ | PROT_WRITE, MAP_SHARED, spill_fd, 0);
+		if(ptr == MAP_FAILED) {
+			close(spill_fd);
+			spill_fd = -1;
+			return;
+		}
+		spill_header = (impl::DensitySpillHeader*)ptr;
+		spill_slots = (impl::DensitySpillSlot*)(spill_header + 1);
+
+		//Reuse the slots of a file written for the same lattice
+		impl::DensitySpillHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "DCACHE1", 8);
+		for(int i=0; i<3; ++i) {
+			header.origin[i] = origin[i];
+			header.spacing[i] = spacing[i];
+		}
+		header.max_level = max_level;
+		header.slots = slots;
+
+		if(existing && memcmp(spill_header, &header, sizeof(header)) == 0) {
+			for(int i=0; i<slots; ++i) {
+				if(!spill_slots[i].used)
+					break;
+				spill_index[spill_slots[i].key] = i;
+				spill_used = i + 1;
+			}
+		}
+		else {
+			memset(ptr, 0, spill_size);
+			*spill_header = header;
+		}
+	}
+
+	void spill(impl::DensityBlockKey const& key, impl::DensityBlock const& block) {
+		if(!spill_slots)
+			return;
+		std::lock_guard<std::mutex> guard(spill_lock);
+		int slot;
+		auto iter = spill_index.find(key);
+		if(iter != spill_index.end()) {
+			slot = iter->second;
+		}
+		else if(spill_used < spill_header->slots) {
+			slot = spill_used++;
+			spill_index[key] = slot;
+		}
+		else {
+			//Full:  replace the slots in turn
+			slot = spill_next;
+			spill_next = (spill_next + 1) % spill_used;
+			spill_index.erase(spill_slots[slot].key);
+			spill_index[key] = slot;
+		}
+		spill_slots[slot].block = block;
+		spill_slots[slot].key = key;
+		spill_slots[slot].used = 1;
+	}
+
+	void unspill(impl::DensityBlockKey const& key, impl::DensityBlock& block) {
+		if(!spill_slots)
+			return;
+		std::lock_guard<std::mutex> guard(spill_lock);
+		auto iter = spill_index.find(key);
+		if(iter != spill_index.end()) {
+			block = spill_slots[iter->second].block;
+		}
+	}
+
+	DensityFunc&		f;
+	Eigen::Vector3f		origin, spacing;
+	int					max_level;
+
+	//In memory blocks
+	int								shard_capacity, shard_count;
+	impl::ScopedArray<Shard>		shards;
+
+	//Spill file
+	std::mutex						spill_lock;
+	int								spill_fd;
+	size_t							spill_size;
+	impl::DensitySpillHeader*		spill_header;
+	impl::DensitySpillSlot*			spill_slots;
+	int								spill_used, spill_next;
+	std::unordered_map<impl::DensityBlockKey, int, impl::DensityBlockKeyHash> spill_index;
+
+	std::atomic<long>	evaluation_count;
+};
+
+};
+
+#endif
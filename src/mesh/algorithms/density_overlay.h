@@ -0,0 +1,486 @@
+#ifndef MESH_DENSITY_OVERLAY_H
+#define MESH_DENSITY_OVERLAY_H
+
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+#include "mesh/algorithms/density.h"
+
+//Blocks cover (1 << DENSITY_OVERLAY_BLOCK_BITS)^3 cells of the lattice
+#define DENSITY_OVERLAY_BLOCK_BITS	3
+#define DENSITY_OVERLAY_BLOCK_CELLS	(1 << DENSITY_OVERLAY_BLOCK_BITS)
+#define DENSITY_OVERLAY_BLOCK_SIDE	(DENSITY_OVERLAY_BLOCK_CELLS + 1)
+
+namespace Mesh {
+
+///What a brush of a DensityOverlay does to the density inside it
+enum DensityBrush {
+	///Makes the density negative inside the brush (fills for densities which are negative inside solids)
+	DENSITY_BRUSH_NEGATIVE,
+	///Makes the density positive inside the brush
+	DENSITY_BRUSH_POSITIVE
+};
+
+namespace impl {
+
+	/**
+	 * Deltas of the lattice points of a block of cells, including the points
+	 * on its far faces, which it shares with the next blocks.  Any point in
+	 * the block can then be interpolated from the block alone.
+	 */
+	struct DensityOverlayBlock {
+		DensityOverlayBlock() {
+			for(int i=0; i<DENSITY_OVERLAY_BLOCK_SIDE*DENSITY_OVERLAY_BLOCK_SIDE*DENSITY_OVERLAY_BLOCK_SIDE; ++i)
+				values[i] = 0.f;
+			range = Eigen::Vector2f(0.f, 0.f);
+		}
+
+		float& at(Eigen::Vector3i const& q) {
+			return values[(q[2] * DENSITY_OVERLAY_BLOCK_SIDE + q[1]) * DENSITY_OVERLAY_BLOCK_SIDE + q[0]];
+		}
+
+		float values[DENSITY_OVERLAY_BLOCK_SIDE*DENSITY_OVERLAY_BLOCK_SIDE*DENSITY_OVERLAY_BLOCK_SIDE];
+
+		///Range of the values, for bounds
+		Eigen::Vector2f range;
+	};
+
+	///Rounds x / 2^bits down
+	inline int floor_shift(int x, int bits) {
+		return x >= 0 ? x >> bits : -((-x + (1 << bits) - 1) >> bits);
+	}
+};
+
+/**
+ * Local edits of a density.
+ *
+ * DensityOverlay wraps a density f and is itself a density, equal to f plus
+ * a delta which is interpolated trilinearly from its values on the lattice
+ * origin + i * spacing.  The deltas are stored sparsely, in blocks of cells
+ * which are allocated by the edits, so f is not modified and editing does not
+ * depend on how it is computed.
+ *
+ * The brushes work on the lattice points they cover:  sphere and box combine
+ * the edited density with the signed distance to the brush, and smooth
+ * blends it with the average of its neighbours.  They sample f on the
+ * lattice around the brush, so an edit costs time proportional to the volume
+ * of the brush.  Each returns whether the density changed and, if so, the
+ * box outside which it did not, which can be passed to
+ * ContourContext::update or used to pick the chunks to contour again.
+ *
+ * The row evaluator and bounds skip the deltas unless the row or box meets
+ * an edited block, so regions which have not been edited cost the same as f.
+ * bounds is only defined when f implements bounds.  Evaluation only reads the
+ * overlay, but edits must not run concurrently with it.  To edit the samples
+ * of isocontour(f, lo, hi, res) exactly, use origin = lo and
+ * spacing = (hi - lo) / res.
+ */
+template<typename DensityFunc>
+struct DensityOverlay {
+
+	DensityOverlay(
+		DensityFunc& f_,
+		Eigen::Vector3f const& origin_,
+		Eigen::Vector3f const& spacing_) :
+		f(f_),
+		origin(origin_),
+		spacing(spacing_),
+		edited_lo(0, 0, 0),
+		edited_hi(-1, -1, -1) {}
+
+	~DensityOverlay() {
+		clear();
+	}
+
+	float operator()(Eigen::Vector3f const& p) {
+		const float v = f(p);
+		impl::DensityOverlayBlock* block = NULL;
+		Eigen::Vector3i key(0, 0, 0);
+		return v + delta(p, block, key);
+	}
+
+	void operator()(
+		Eigen::Vector3f const& row_origin,
+		Eigen::Vector3f const& step,
+		int count,
+		float* out) {
+
+		impl::sample_row(f, row_origin, step, count, out);
+		if(count <= 0)
+			return;
+
+		const Eigen::Vector3f row_end = row_origin + (float)(count - 1) * step;
+		if(!meets_edits(row_origin.cwiseMin(row_end), row_origin.cwiseMax(row_end)))
+			return;
+
+		//Consecutive points usually fall in the same block
+		impl::DensityOverlayBlock* block = NULL;
+		Eigen::Vector3i key(0, 0, 0);
+		for(int i=0; i<count; ++i)
+			out[i] += delta((row_origin + (float)i * step).eval(), block, key);
+	}
+
+	///Range [min,max] containing the edited density on the closed box [lo,hi]
+	template<typename F = DensityFunc>
+	auto bounds(
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& hi) -> decltype(std::declval<F&>().bounds(lo, hi)) {
+
+		Eigen::Vector2f range = f.bounds(lo, hi);
+		if(!meets_edits(lo, hi))
+			return range;
+
+		Eigen::Vector3i b0, b1;
+		block_range(lo, hi, b0, b1);
+		Eigen::Vector2f delta_range(0.f, 0.f);
+		const Eigen::Vector3i span = b1 - b0 + Eigen::Vector3i(1, 1, 1);
+		if((long)span[0] * span[1] * span[2] < (long)blocks.size()) {
+			for(int z=b0[2]; z<=b1[2]; ++z)
+			for(int y=b0[1]; y<=b1[1]; ++y)
+			for(int x=b0[0]; x<=b1[0]; ++x) {
+				typename BlockGrid::const_iterator it = blocks.find(Eigen::Vector3i(x, y, z));
+				if(it == blocks.end())
+					continue;
+				delta_range[0] = std::min(delta_range[0], it->second->range[0]);
+				delta_range[1] = std::max(delta_range[1], it->second->range[1]);
+			}
+		}
+		else {
+			for(typename BlockGrid::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+				if(((it->first - b0).array() < 0).any() || ((it->first - b1).array() > 0).any())
+					continue;
+				delta_range[0] = std::min(delta_range[0], it->second->range[0]);
+				delta_range[1] = std::max(delta_range[1], it->second->range[1]);
+			}
+		}
+		return range + delta_range;
+	}
+
+	/**
+	 * Makes the density negative or positive inside the sphere, by taking the
+	 * min of the density and the signed distance to the sphere, or the max of
+	 * the density and minus that distance.
+	 */
+	bool sphere(
+		Eigen::Vector3f const& center,
+		float radius,
+		DensityBrush brush,
+		Eigen::Vector3f& dirty_lo,
+		Eigen::Vector3f& dirty_hi) {
+
+		const Eigen::Vector3f r(radius, radius, radius);
+		Eigen::Vector3i q0, q1;
+		if(!lattice_range((center - r).eval(), (center + r).eval(), q0, q1))
+			return false;
+
+		std::vector<float> base, values;
+		sample(q0, q1, base, values);
+		const Eigen::Vector3i n = q1 - q0 + Eigen::Vector3i(1, 1, 1);
+		for(int z=0; z<n[2]; ++z)
+		for(int y=0; y<n[1]; ++y)
+		for(int x=0; x<n[0]; ++x) {
+			const Eigen::Vector3f p = point((q0 + Eigen::Vector3i(x, y, z)).eval());
+			float& v = values[(z * n[1] + y) * n[0] + x];
+			v = combine(v, (p - center).norm() - radius, brush);
+		}
+		return store(q0, q1, base, values, dirty_lo, dirty_hi);
+	}
+
+	///Makes the density negative or positive inside the box [lo,hi], like sphere
+	bool box(
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& hi,
+		DensityBrush brush,
+		Eigen::Vector3f& dirty_lo,
+		Eigen::Vector3f& dirty_hi) {
+
+		Eigen::Vector3i q0, q1;
+		if(!lattice_range(lo, hi, q0, q1))
+			return false;
+
+		const Eigen::Vector3f center = (lo + hi) * 0.5f, half = (hi - lo) * 0.5f;
+		std::vector<float> base, values;
+		sample(q0, q1, base, values);
+		const Eigen::Vector3i n = q1 - q0 + Eigen::Vector3i(1, 1, 1);
+		for(int z=0; z<n[2]; ++z)
+		for(int y=0; y<n[1]; ++y)
+		for(int x=0; x<n[0]; ++x) {
+			const Eigen::Vector3f p = point((q0 + Eigen::Vector3i(x, y, z)).eval());
+			const Eigen::Vector3f d = ((p - center).cwiseAbs() - half).eval();
+			const float distance = d.cwiseMax(Eigen::Vector3f(0, 0, 0)).norm() + std::min(d.maxCoeff(), 0.f);
+			float& v = values[(z * n[1] + y) * n[0] + x];
+			v = combine(v, distance, brush);
+		}
+		return store(q0, q1, base, values, dirty_lo, dirty_hi);
+	}
+
+	/**
+	 * Moves the density at the lattice points inside the sphere towards the
+	 * average of their 6 neighbours, by strength (in [0,1]) at the center
+	 * falling off linearly to 0 at the radius.
+	 */
+	bool smooth(
+		Eigen::Vector3f const& center,
+		float radius,
+		float strength,
+		Eigen::Vector3f& dirty_lo,
+		Eigen::Vector3f& dirty_hi) {
+
+		const Eigen::Vector3f r(radius, radius, radius);
+		Eigen::Vector3i q0, q1;
+		if(!lattice_range((center - r).eval(), (center + r).eval(), q0, q1))
+			return false;
+
+		//Sample a point further on each side for the neighbours
+		const Eigen::Vector3i one(1, 1, 1);
+		std::vector<float> base, values;
+		sample((q0 - one).eval(), (q1 + one).eval(), base, values);
+		const Eigen::Vector3i m = q1 - q0 + 3 * one;
+
+		const Eigen::Vector3i n = q1 - q0 + one;
+		std::vector<float> inner_base(n[0] * n[1] * n[2]), result(n[0] * n[1] * n[2]);
+		for(int z=0; z<n[2]; ++z)
+		for(int y=0; y<n[1]; ++y)
+		for(int x=0; x<n[0]; ++x) {
+			const int i = ((z + 1) * m[1] + y + 1) * m[0] + x + 1;
+			const float average = (
+				values[i - 1] + values[i + 1] +
+				values[i - m[0]] + values[i + m[0]] +
+				values[i - m[0] * m[1]] + values[i + m[0] * m[1]]) / 6.f;
+
+			const Eigen::Vector3f p = point((q0 + Eigen::Vector3i(x, y, z)).eval());
+			const float w = strength * std::max(0.f, 1.f - (p - center).norm() / radius);
+			inner_base[(z * n[1] + y) * n[0] + x] = base[i];
+			result[(z * n[1] + y) * n[0] + x] = values[i] + w * (average - values[i]);
+		}
+		return store(q0, q1, inner_base, result, dirty_lo, dirty_hi);
+	}
+
+	///Removes all edits
+	void clear() {
+		for(typename BlockGrid::iterator it = blocks.begin(); it != blocks.end(); ++it)
+			delete it->second;
+		blocks.clear();
+		edited_lo = Eigen::Vector3f(0, 0, 0);
+		edited_hi = Eigen::Vector3f(-1, -1, -1);
+	}
+
+	///Number of allocated blocks
+	int block_count() const {
+		return (int)blocks.size();
+	}
+
+	DensityFunc& f;
+	Eigen::Vector3f origin, spacing;
+
+private:
+	typedef typename impl::SpatialGrid<impl::DensityOverlayBlock*>::type BlockGrid;
+
+	Eigen::Vector3f point(Eigen::Vector3i const& q) const {
+		return origin + (q.cast<float>().array() * spacing.array()).matrix();
+	}
+
+	static float combine(float v, float distance, DensityBrush brush) {
+		return brush == DENSITY_BRUSH_NEGATIVE ? std::min(v, distance) : std::max(v, -distance);
+	}
+
+	///Whether the box [lo,hi] meets an edited block
+	bool meets_edits(Eigen::Vector3f const& lo, Eigen::Vector3f const& hi) const {
+		return	(lo.array() <= edited_hi.array()).all() &&
+				(hi.array() >= edited_lo.array()).all();
+	}
+
+	///Range of the blocks whose cells meet the box [lo,hi]
+	void block_range(
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& hi,
+		Eigen::Vector3i& b0,
+		Eigen::Vector3i& b1) const {
+		for(int i=0; i<3; ++i) {
+			b0[i] = impl::floor_shift((int)std::floor((lo[i] - origin[i]) / spacing[i]), DENSITY_OVERLAY_BLOCK_BITS);
+			b1[i] = impl::floor_shift((int)std::floor((hi[i] - origin[i]) / spacing[i]), DENSITY_OVERLAY_BLOCK_BITS);
+		}
+	}
+
+	///Range [q0,q1] of the lattice points in the box [lo,hi], false if there are none
+	bool lattice_range(
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& hi,
+		Eigen::Vector3i& q0,
+		Eigen::Vector3i& q1) const {
+		for(int i=0; i<3; ++i) {
+			q0[i] = (int)std::ceil((lo[i] - origin[i]) / spacing[i]);
+			q1[i] = (int)std::floor((hi[i] - origin[i]) / spacing[i]);
+			if(q0[i] > q1[i])
+				return false;
+		}
+		return true;
+	}
+
+	///Interpolated delta at p, block and key remember the last block looked up
+	float delta(
+		Eigen::Vector3f const& p,
+		impl::DensityOverlayBlock*& block,
+		Eigen::Vector3i& key) const {
+
+		if(!meets_edits(p, p))
+			return 0.f;
+
+		Eigen::Vector3f t;
+		Eigen::Vector3i cell, b;
+		for(int i=0; i<3; ++i) {
+			const float x = (p[i] - origin[i]) / spacing[i];
+			cell[i] = (int)std::floor(x);
+			t[i] = x - cell[i];
+			b[i] = impl::floor_shift(cell[i], DENSITY_OVERLAY_BLOCK_BITS);
+		}
+		if(!block || b != key) {
+			key = b;
+			typename BlockGrid::const_iterator it = blocks.find(b);
+			block = it == blocks.end() ? NULL : it->second;
+		}
+		if(!block)
+			return 0.f;
+
+		const Eigen::Vector3i c = cell - b * DENSITY_OVERLAY_BLOCK_CELLS;
+		const int sy = DENSITY_OVERLAY_BLOCK_SIDE, sz = sy * sy;
+		const float* v = &block->at(c);
+		const float x00 = v[0]       + t[0] * (v[1]       - v[0]);
+		const float x10 = v[sy]      + t[0] * (v[sy+1]    - v[sy]);
+		const float x01 = v[sz]      + t[0] * (v[sz+1]    - v[sz]);
+		const float x11 = v[sz+sy]   + t[0] * (v[sz+sy+1] - v[sz+sy]);
+		const float y0 = x00 + t[1] * (x10 - x00);
+		const float y1 = x01 + t[1] * (x11 - x01);
+		return y0 + t[2] * (y1 - y0);
+	}
+
+	///Delta at the lattice point q
+	float lattice_delta(Eigen::Vector3i const& q) const {
+		Eigen::Vector3i b;
+		for(int i=0; i<3; ++i)
+			b[i] = impl::floor_shift(q[i], DENSITY_OVERLAY_BLOCK_BITS);
+		typename BlockGrid::const_iterator it = blocks.find(b);
+		if(it == blocks.end())
+			return 0.f;
+		return it->second->at((q - b * DENSITY_OVERLAY_BLOCK_CELLS).eval());
+	}
+
+	/**
+	 * Samples f and the edited density on the lattice points [q0,q1] to base
+	 * and values, x varying fastest.
+	 */
+	void sample(
+		Eigen::Vector3i const& q0,
+		Eigen::Vector3i const& q1,
+		std::vector<float>& base,
+		std::vector<float>& values) {
+
+		const Eigen::Vector3i n = q1 - q0 + Eigen::Vector3i(1, 1, 1);
+		base.resize(n[0] * n[1] * n[2]);
+		values.resize(n[0] * n[1] * n[2]);
+		const Eigen::Vector3f step(spacing[0], 0, 0);
+		for(int z=0; z<n[2]; ++z)
+		for(int y=0; y<n[1]; ++y) {
+			const int row = (z * n[1] + y) * n[0];
+			impl::sample_row(f, point((q0 + Eigen::Vector3i(0, y, z)).eval()), step, n[0], &base[row]);
+			for(int x=0; x<n[0]; ++x)
+				values[row + x] = base[row + x] + lattice_delta((q0 + Eigen::Vector3i(x, y, z)).eval());
+		}
+	}
+
+	/**
+	 * Stores the edited density values of the lattice points [q0,q1] as
+	 * deltas from the samples base of f, and computes the box the density
+	 * changed in.
+	 */
+	bool store(
+		Eigen::Vector3i const& q0,
+		Eigen::Vector3i const& q1,
+		std::vector<float> const& base,
+		std::vector<float> const& values,
+		Eigen::Vector3f& dirty_lo,
+		Eigen::Vector3f& dirty_hi) {
+
+		const Eigen::Vector3i n = q1 - q0 + Eigen::Vector3i(1, 1, 1);
+		Eigen::Vector3i c0 = q1, c1 = q0;
+		bool changed = false;
+		for(int z=0; z<n[2]; ++z)
+		for(int y=0; y<n[1]; ++y)
+		for(int x=0; x<n[0]; ++x) {
+			const int i = (z * n[1] + y) * n[0] + x;
+			const Eigen::Vector3i q = q0 + Eigen::Vector3i(x, y, z);
+			const float d = values[i] - base[i];
+			if(d == lattice_delta(q))
+				continue;
+			set_delta(q, d);
+			c0 = c0.cwiseMin(q);
+			c1 = c1.cwiseMax(q);
+			changed = true;
+		}
+		if(!changed)
+			return false;
+
+		//The interpolated delta depends on the points of the enclosing cell
+		const Eigen::Vector3i one(1, 1, 1);
+		dirty_lo = point((c0 - one).eval());
+		dirty_hi = point((c1 + one).eval());
+		return true;
+	}
+
+	///Writes the delta of the lattice point q to every block which holds it
+	void set_delta(Eigen::Vector3i const& q, float d) {
+		Eigen::Vector3i b0, b1;
+		for(int i=0; i<3; ++i) {
+			b1[i] = impl::floor_shift(q[i], DENSITY_OVERLAY_BLOCK_BITS);
+			b0[i] = (q[i] & (DENSITY_OVERLAY_BLOCK_CELLS - 1)) == 0 ? b1[i] - 1 : b1[i];
+		}
+		for(int z=b0[2]; z<=b1[2]; ++z)
+		for(int y=b0[1]; y<=b1[1]; ++y)
+		for(int x=b0[0]; x<=b1[0]; ++x) {
+			const Eigen::Vector3i b(x, y, z);
+			impl::DensityOverlayBlock* block = fetch(b);
+			block->at((q - b * DENSITY_OVERLAY_BLOCK_CELLS).eval()) = d;
+			block->range[0] = std::min(block->range[0], d);
+			block->range[1] = std::max(block->range[1], d);
+		}
+	}
+
+	///Returns the block b, creating it if necessary
+	impl::DensityOverlayBlock* fetch(Eigen::Vector3i const& b) {
+		typename BlockGrid::iterator it = blocks.find(b);
+		if(it != blocks.end())
+			return it->second;
+
+		impl::DensityOverlayBlock* block = new impl::DensityOverlayBlock();
+		blocks[b] = block;
+
+		const Eigen::Vector3f lo = point((b * DENSITY_OVERLAY_BLOCK_CELLS).eval());
+		const Eigen::Vector3f hi = point(((b + Eigen::Vector3i(1, 1, 1)) * DENSITY_OVERLAY_BLOCK_CELLS).eval());
+		if(blocks.size() == 1) {
+			edited_lo = lo;
+			edited_hi = hi;
+		}
+		else {
+			edited_lo = edited_lo.cwiseMin(lo);
+			edited_hi = edited_hi.cwiseMax(hi);
+		}
+		return block;
+	}
+
+	DensityOverlay(DensityOverlay const&);
+	DensityOverlay& operator=(DensityOverlay const&);
+
+	BlockGrid		blocks;
+
+	//Box of the allocated blocks, empty when there are none
+	Eigen::Vector3f	edited_lo, edited_hi;
+};
+
+};
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef MESH_DUAL_CONTOUR_H
+#define MESH_DUAL_CONTOUR_H
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+#include <Eigen/SVD>
+
+#include "mesh/implementation/util.h"
+#include "mesh/core/trimesh.h"
+#include "mesh/algorithms/density.h"
+#include "mesh/algorithms/contour.h"
+
+//Singular values below this fraction of the largest are treated as 0
+#define QEF_SVD_TOLERANCE	0.1
+
+namespace Mesh {
+namespace impl {
+
+	/**
+	 * Quadratic error function for dual contouring.
+	 *
+	 * Accumulates the tangent planes n . (x - p) = 0 of the surface at the edge
+	 * crossings of a cell.  QEFs are additive, so the error of a merged cell is
+	 * computed from the sums without revisiting the crossings.
+	 */
+	struct QEF {
+		Eigen::Matrix3f		ata;
+		Eigen::Vector3f		atb;
+		float				btb;
+		Eigen::Vector3f		mass;
+		int					n;
+
+		QEF() :
+			ata(Eigen::Matrix3f::Zero()),
+			atb(Eigen::Vector3f::Zero()),
+			btb(0),
+			mass(Eigen::Vector3f::Zero()),
+			n(0) {}
+
+		///Adds the plane through p with normal nrm
+		void add(Eigen::Vector3f const& p, Eigen::Vector3f const& nrm) {
+			const float d = nrm.dot(p);
+			ata		+= nrm * nrm.transpose();
+			atb		+= d * nrm;
+			btb		+= d * d;
+			mass	+= p;
+			++n;
+		}
+
+		void merge(QEF const& other) {
+			ata		+= other.ata;
+			atb		+= other.atb;
+			btb		+= other.btb;
+			mass	+= other.mass;
+			n		+= other.n;
+		}
+
+		///Returns the squared residual of the planes at x
+		float error(Eigen::Vector3f const& x) const {
+			return x.dot(ata * x) - 2 * x.dot(atb) + btb;
+		}
+
+		/**
+		 * Minimizes the QEF with a truncated pseudo-inverse, solving relative to
+		 * the mass point so that under-determined directions stay centered.
+		 * The result is clamped to the box [lo,hi] by falling back to the mass
+		 * point.
+		 */
+		Eigen::Vector3f solve(
+			Eigen::Vector3f const& lo,
+			Eigen::Vector3f const& hi) const {
+
+			const Eigen::Vector3f m = mass / (float)n;
+
+			Eigen::JacobiSVD<Eigen::Matrix3f> svd(ata, Eigen::ComputeFullU | Eigen::ComputeFullV);
+			const Eigen::Vector3f sv = svd.singularValues();
+			Eigen::Vector3f inv(0, 0, 0);
+			for(int i=0; i<3; ++i) {
+				if(sv[i] > QEF_SVD_TOLERANCE * sv[0]) {
+					inv[i] = 1.f / sv[i];
+				}
+			}
+
+			const Eigen::Vector3f rhs = atb - ata * m;
+			const Eigen::Vector3f x = m + svd.matrixV() * inv.asDiagonal() * svd.matrixU().transpose() * rhs;
+
+			if((x.array() < lo.array()).any() || (x.array() > hi.array()).any()) {
+				return m;
+			}
+			return x;
+		}
+	};
+
+	///Node of the simplification octree
+	struct QEFNode {
+		QEFNode() : gradient(0, 0, 0), collapsible(true), vertex(-1) {}
+
+		QEF				qef;
+		Eigen::Vector3f	gradient;	//Sum of the gradients at the crossings
+		bool			collapsible;
+		int				vertex;
+	};
+
+	inline Eigen::Vector3i octree_parent(Eigen::Vector3i const& c) {
+		return Eigen::Vector3i(c[0] >> 1, c[1] >> 1, c[2] >> 1);
+	}
+};
+
+/**
+ * Computes a mesh for the 0-level set of f by dual contouring.
+ *
+ * Samples the same grid as isocontour, but places each cell vertex at the
+ * minimizer of the quadratic error of the tangent planes at its edge
+ * crossings instead of at their average.  This reproduces sharp edges and
+ * corners which fall inside a cell, so that a coarser grid gives the same
+ * fidelity.
+ *
+ * When tolerance > 0, cells are additionally merged bottom up in an octree
+ * whenever the QEF of all the crossings in the merged node has a residual no
+ * larger than tolerance, and share a single vertex.  Faces which collapse are
+ * dropped.  The merge does not check the topology of the node, so a large
+ * tolerance can create non-manifold configurations in thin features.
+ *
+ *  GradientFunc is a lambda of type Eigen::Vector3f -> Eigen::Vector3f
+ *    giving the gradient of f (see CentralDifference)
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename GradientFunc,
+	typename AttributeFunc,
+	typename Vector>
+void isocontour_dual(
+	Mesh& mesh,
+	DensityFunc& f,
+	GradientFunc& grad,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector hi,
+	Eigen::Vector3i res,
+	float tolerance = -1.f) {
+
+	typedef typename impl::SpatialGrid<impl::QEFNode>::type NodeGrid;
+
+	impl::ContourCells cells;
+
+	//Grid size
+	const Vector h = ((hi - lo).array() / Vector(res[0], res[1], res[2]).array()).matrix();
+	lo -= h;
+	for(int i=0; i<3; ++i)
+		res[i] += 2;
+
+	impl::sweep_edges(f, lo, h, res, cells);
+
+	//Gradients at the crossings
+	typename impl::SpatialGrid<Eigen::Vector3f>::type gradients[3];
+	for(int e=0; e<3; ++e) {
+		for(auto iter=cells.edges[e].begin(); iter!=cells.edges[e].end(); ++iter) {
+			const Eigen::Vector3f p = iter->second.template head<3>();
+			gradients[e][iter->first] = grad(p);
+		}
+	}
+
+	//Leaf QEFs
+	std::vector<NodeGrid> levels(1);
+	for(auto iter=cells.vertices.begin(); iter!=cells.vertices.end(); ++iter) {
+		impl::QEFNode& node = levels[0][iter->first];
+		for(int e=0; e<3; ++e) {
+			const int u_dir = (e + 1)%3;
+			const int v_dir = (e + 2)%3;
+
+			for(int u=0; u<=1; ++u)
+			for(int v=0; v<=1; ++v) {
+				Eigen::Vector3i tmp(iter->first);
+				tmp[u_dir] += u;
+				tmp[v_dir] += v;
+
+				auto e_iter = cells.edges[e].find(tmp);
+				if(e_iter == cells.edges[e].end())
+					continue;
+
+				//Tangent plane
+				const Eigen::Vector3f g = gradients[e][tmp];
+				Eigen::Vector3f nrm = g;
+				const float l = nrm.norm();
+				if(l > FP_TOLERANCE) {
+					nrm /= l;
+				}
+				node.qef.add(e_iter->second.template head<3>(), nrm);
+				node.gradient += g;
+			}
+		}
+	}
+
+	//Merge nodes bottom up while the residual stays within tolerance
+	if(tolerance > 0) {
+		while(levels.back().size() > 1) {
+			NodeGrid& children = levels.back();
+			NodeGrid parents;
+			for(auto iter=children.begin(); iter!=children.end(); ++iter) {
+				impl::QEFNode& parent = parents[impl::octree_parent(iter->first)];
+				parent.qef.merge(iter->second.qef);
+				parent.gradient += iter->second.gradient;
+				parent.collapsible = parent.collapsible && iter->second.collapsible;
+			}
+
+			const float size = (float)(1 << levels.size());
+			bool any = false;
+			for(auto iter=parents.begin(); iter!=parents.end(); ++iter) {
+				if(!iter->second.collapsible)
+					continue;
+				const Vector n_lo = (iter->first.template cast<float>().array() * size * h.array() + lo.array()).matrix();
+				const Vector n_hi = (n_lo.array() + size * h.array()).matrix();
+				const Eigen::Vector3f x = iter->second.qef.solve(n_lo, n_hi);
+				iter->second.collapsible = iter->second.qef.error(x) <= tolerance;
+				any = any || iter->second.collapsible;
+			}
+
+			if(!any)
+				break;
+			levels.push_back(parents);
+		}
+	}
+
+	//Place one vertex per maximal collapsed node
+	for(auto iter=cells.vertices.begin(); iter!=cells.vertices.end(); ++iter) {
+		Eigen::Vector3i coord = iter->first;
+		Eigen::Vector3i node_coord = coord;
+		int level = 0;
+		for(int l=1; l<(int)levels.size(); ++l) {
+			coord = impl::octree_parent(coord);
+			if(!levels[l][coord].collapsible)
+				break;
+			node_coord = coord;
+			level = l;
+		}
+
+		impl::QEFNode& node = levels[level][node_coord];
+		if(node.vertex < 0) {
+			const float size = (float)(1 << level);
+			const Vector n_lo = (node_coord.template cast<float>().array() * size * h.array() + lo.array()).matrix();
+			const Vector n_hi = (n_lo.array() + size * h.array()).matrix();
+			node.vertex = mesh.add_vertex(impl::make_vertex(
+				attr, node.qef.solve(n_lo, n_hi), (node.gradient / (float)node.qef.n).eval()));
+		}
+		iter->second = node.vertex;
+	}
+
+	cells.generate_faces(mesh, res);
+}
+
+/**
+ * Dual contouring with gradients estimated by central differences of f.
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename AttributeFunc,
+	typename Vector>
+void isocontour_dual(
+	Mesh& mesh,
+	DensityFunc& f,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector hi,
+	Eigen::Vector3i res,
+	float tolerance = -1.f) {
+
+	const Vector h = ((hi - lo).array() / Vector(res[0], res[1], res[2]).array()).matrix();
+	CentralDifference<DensityFunc> grad(f, 1e-2f * h.minCoeff());
+	isocontour_dual(mesh, f, grad, attr, lo, hi, res, tolerance);
+}
+
+};
+
+#endif
+
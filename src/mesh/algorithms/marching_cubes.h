@@ -0,0 +1,333 @@
+#ifndef MESH_MARCHING_CUBES_H
+#define MESH_MARCHING_CUBES_H
+
+#include <cstring>
+#include <stdint.h>
+#include <algorithm>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+#include "mesh/core/trimesh.h"
+#include "mesh/algorithms/density.h"
+
+namespace Mesh {
+namespace impl {
+
+	/**
+	 * Compile time generation of the marching cubes case tables.
+	 *
+	 * Corner c of a cell sits at offset (c&1, (c>>1)&1, (c>>2)&1), and is
+	 * inside when the density there is negative.  Edge e runs along axis e>>2
+	 * from corner mc_edge_corner0(e), with bits (e&1, (e>>1)&1) giving its offset in
+	 * the two other axes (in cyclic order).
+	 *
+	 * The triangles of a case are found by tracing the contour around the
+	 * faces of the cube.  On each face, viewed from outside with corners in
+	 * counter clockwise order, the contour runs from every edge where it enters
+	 * the inside corners to the next edge where it exits them.  Ambiguous faces
+	 * therefore always separate the inside corners, and since the rule only
+	 * depends on the face, neighboring cells agree and the surface is closed.
+	 * Each closed loop is then fanned into triangles.
+	 *
+	 * A loop may cross an ambiguous face twice, and a fan whose apex lies on
+	 * that face would put a triangle in it, which the neighboring cell can
+	 * duplicate.  The apex is therefore an edge whose two faces the loop
+	 * crosses once each;  every loop of every case has one.
+	 */
+	constexpr int mc_edge_axis(int e) {
+		return e >> 2;
+	}
+	constexpr int mc_edge_corner0(int e) {
+		return ((e & 1) << ((mc_edge_axis(e)+1)%3)) | (((e & 3) >> 1) << ((mc_edge_axis(e)+2)%3));
+	}
+	constexpr int mc_edge_corner1(int e) {
+		return mc_edge_corner0(e) | (1 << mc_edge_axis(e));
+	}
+	constexpr int mc_axis_of(int bit) {
+		return bit == 1 ? 0 : (bit == 2 ? 1 : 2);
+	}
+	constexpr int mc_edge_from(int lo, int a) {
+		return a*4 + (((lo >> ((a+1)%3)) & 1) | (((lo >> ((a+2)%3)) & 1) << 1));
+	}
+	constexpr int mc_edge_between(int c0, int c1) {
+		return mc_edge_from(c0 & c1, mc_axis_of(c0 ^ c1));
+	}
+
+	//Faces are numbered 2*axis + side, corners are counter clockwise from outside
+	constexpr int mc_quad_u(int k) {
+		return (k == 1 || k == 2) ? 1 : 0;
+	}
+	constexpr int mc_quad_v(int k) {
+		return k >= 2 ? 1 : 0;
+	}
+	constexpr int mc_face_k(int f, int k) {
+		return (f & 1) ? (k & 3) : ((4 - (k & 3)) & 3);
+	}
+	constexpr int mc_face_corner(int f, int k) {
+		return	((f & 1) << (f >> 1)) |
+				(mc_quad_u(mc_face_k(f, k)) << (((f >> 1)+1)%3)) |
+				(mc_quad_v(mc_face_k(f, k)) << (((f >> 1)+2)%3));
+	}
+	constexpr int mc_face_edge(int f, int k) {
+		return mc_edge_between(mc_face_corner(f, k), mc_face_corner(f, k+1));
+	}
+	constexpr int mc_edge_face(int e, int i) {
+		return i == 0 ?
+			2*((mc_edge_axis(e)+1)%3) + (e & 1) :
+			2*((mc_edge_axis(e)+2)%3) + ((e & 3) >> 1);
+	}
+
+	//Contour tracing for case c
+	constexpr bool mc_inside(int c, int corner) {
+		return (c >> corner) & 1;
+	}
+	constexpr bool mc_crossing(int c, int e) {
+		return mc_inside(c, mc_edge_corner0(e)) != mc_inside(c, mc_edge_corner1(e));
+	}
+	constexpr bool mc_entering(int c, int f, int k) {
+		return !mc_inside(c, mc_face_corner(f, k)) && mc_inside(c, mc_face_corner(f, k+1));
+	}
+	constexpr bool mc_exiting(int c, int f, int k) {
+		return mc_inside(c, mc_face_corner(f, k)) && !mc_inside(c, mc_face_corner(f, k+1));
+	}
+	constexpr int mc_find_k(int f, int e, int k) {
+		return k >= 4 ? -1 : (mc_face_edge(f, k) == e ? k : mc_find_k(f, e, k+1));
+	}
+	constexpr int mc_scan_exit(int c, int f, int k, int n) {
+		return n == 0 ? -1 : (mc_exiting(c, f, k) ? mc_face_edge(f, k) : mc_scan_exit(c, f, (k+1)&3, n-1));
+	}
+	constexpr int mc_next_in_face(int c, int f, int k) {
+		return (k >= 0 && mc_entering(c, f, k)) ? mc_scan_exit(c, f, (k+1)&3, 4) : -1;
+	}
+	constexpr int mc_either(int a, int b) {
+		return a >= 0 ? a : b;
+	}
+	constexpr int mc_next_edge(int c, int e) {
+		return mc_either(
+			mc_next_in_face(c, mc_edge_face(e, 0), mc_find_k(mc_edge_face(e, 0), e, 0)),
+			mc_next_in_face(c, mc_edge_face(e, 1), mc_find_k(mc_edge_face(e, 1), e, 0)));
+	}
+	constexpr int mc_walk(int c, int e, int n) {
+		return n == 0 ? e : mc_walk(c, mc_next_edge(c, e), n-1);
+	}
+	constexpr int mc_loop_min(int c, int e, int cur, int m) {
+		return cur == e ? m : mc_loop_min(c, e, mc_next_edge(c, cur), cur < m ? cur : m);
+	}
+	constexpr int mc_loop_length(int c, int e, int cur, int n) {
+		return cur == e ? n : mc_loop_length(c, e, mc_next_edge(c, cur), n+1);
+	}
+	constexpr bool mc_loop_head(int c, int e) {
+		return mc_crossing(c, e) && mc_loop_min(c, e, mc_next_edge(c, e), e) == e;
+	}
+	constexpr int mc_loop_entries(int c, int e) {
+		return mc_loop_head(c, e) ? 3 * (mc_loop_length(c, e, mc_next_edge(c, e), 1) - 2) : 0;
+	}
+	constexpr int mc_common_face(int a, int b) {
+		return	(mc_edge_face(a, 0) == mc_edge_face(b, 0) || mc_edge_face(a, 0) == mc_edge_face(b, 1)) ?
+			mc_edge_face(a, 0) : mc_edge_face(a, 1);
+	}
+	///Number of steps of the loop from cur back to e which cross face f
+	constexpr int mc_face_visits(int c, int e, int cur, int f) {
+		return	(mc_common_face(cur, mc_next_edge(c, cur)) == f ? 1 : 0) +
+			(mc_next_edge(c, cur) == e ? 0 : mc_face_visits(c, e, mc_next_edge(c, cur), f));
+	}
+	constexpr bool mc_good_apex(int c, int e) {
+		return	mc_face_visits(c, e, e, mc_edge_face(e, 0)) == 1 &&
+			mc_face_visits(c, e, e, mc_edge_face(e, 1)) == 1;
+	}
+	constexpr int mc_apex(int c, int e, int cur) {
+		return mc_good_apex(c, cur) ? cur : (mc_next_edge(c, cur) == e ? e : mc_apex(c, e, mc_next_edge(c, cur)));
+	}
+	constexpr int mc_fan(int c, int e, int k) {
+		return (k % 3) == 0 ? e : mc_walk(c, e, k/3 + k%3);
+	}
+
+	///k-th edge in the triangle list of case c, or -1 past the end
+	constexpr int mc_triangle_edge(int c, int k, int e) {
+		return e >= 12 ? -1 :
+			(k < mc_loop_entries(c, e) ?
+				mc_fan(c, mc_apex(c, e, e), k) :
+				mc_triangle_edge(c, k - mc_loop_entries(c, e), e+1));
+	}
+
+	///Bit mask of the crossing edges of case c
+	constexpr int mc_edge_mask(int c, int e) {
+		return e >= 12 ? 0 : ((mc_crossing(c, e) ? (1 << e) : 0) | mc_edge_mask(c, e+1));
+	}
+
+	/**
+	 * Gradient of the trilinear interpolant of the corner values of a cell of
+	 * size h at local coordinates t in [0,1]^3.
+	 */
+	inline Eigen::Vector3f mc_gradient(
+		const float* values,
+		Eigen::Array3f const& t,
+		Eigen::Vector3f const& h) {
+
+		Eigen::Vector3f result(0, 0, 0);
+		for(int c=0; c<8; ++c) {
+			float w[3], dw[3];
+			for(int i=0; i<3; ++i) {
+				const bool bit = (c >> i) & 1;
+				w[i] = bit ? t[i] : 1.f - t[i];
+				dw[i] = bit ? 1.f : -1.f;
+			}
+			result[0] += values[c] * dw[0] * w[1] * w[2];
+			result[1] += values[c] * w[0] * dw[1] * w[2];
+			result[2] += values[c] * w[0] * w[1] * dw[2];
+		}
+		return (result.array() / h.array()).matrix();
+	}
+
+	template<int... I> struct IndexSeq {};
+	template<int N, int... I> struct MakeIndexSeq : MakeIndexSeq<N-1, N-1, I...> {};
+	template<int... I> struct MakeIndexSeq<0, I...> {
+		typedef IndexSeq<I...> type;
+	};
+
+	///At most 5 triangles per case, terminated by -1
+	struct MCCase {
+		int8_t edges[16];
+	};
+
+	struct MCCaseTable {
+		MCCase		cases[256];
+		uint16_t	edge_mask[256];
+	};
+
+	template<int... K>
+	constexpr MCCase mc_make_case(int c, IndexSeq<K...>) {
+		return MCCase{{ (int8_t)mc_triangle_edge(c, K, 0)... }};
+	}
+
+	template<int... C>
+	constexpr MCCaseTable mc_make_table(IndexSeq<C...>) {
+		return MCCaseTable{
+			{ mc_make_case(C, typename MakeIndexSeq<16>::type())... },
+			{ (uint16_t)mc_edge_mask(C, 0)... } };
+	}
+
+	template<typename Dummy = void>
+	struct MarchingCubesTables {
+		static constexpr MCCaseTable table = mc_make_table(typename MakeIndexSeq<256>::type());
+	};
+	template<typename Dummy>
+	constexpr MCCaseTable MarchingCubesTables<Dummy>::table;
+};
+
+/**
+ * Computes a triangle mesh for the 0-level set of f by marching cubes.
+ *
+ * Unlike isocontour, the grid covers exactly [lo,hi] with res cells and
+ * every vertex lies on a grid edge, so chunks which share a face produce
+ * matching boundary vertices without any cross chunk lookup.  The sweep samples
+ * f one slab at a time with the same code as isocontour, and shares edge
+ * vertices between cells through per slab index buffers.
+ *
+ *  Mesh is of type TriMesh<VertexData>
+ *  DensityFunc is a lambda of type Eigen::Vector3f -> float, optionally with
+ *    a batched row evaluator (see mesh/algorithms/density.h)
+ *  AttributeFunc is a lambda of type Eigen::Vector3f -> VertexData
+ */
+template<
+	typename Mesh,
+	typename DensityFunc,
+	typename AttributeFunc,
+	typename Vector>
+void marching_cubes(
+	Mesh& mesh,
+	DensityFunc& f,
+	AttributeFunc& attr,
+	Vector lo,
+	Vector hi,
+	Eigen::Vector3i res) {
+
+	const impl::MCCaseTable& table = impl::MarchingCubesTables<>::table;
+
+	//Grid size
+	const Vector h = ((hi - lo).array() / Vector(res[0], res[1], res[2]).array()).matrix();
+	const int nx = res[0] + 1, ny = res[1] + 1, slab = nx * ny;
+
+	//Slab samples
+	float* above = new float[slab];
+	float* below = new float[slab];
+	impl::ScopedArray<float> aguard(above), bguard(below);
+
+	//Vertex names of the x/y edges in the bottom/top layer and of the z edges
+	int* buffer = new int[5 * slab];
+	impl::ScopedArray<int> buffer_guard(buffer);
+	int* xy_edges[2][2] = {
+		{ buffer,				buffer + slab },
+		{ buffer + 2 * slab,	buffer + 3 * slab } };
+	int* z_edges = buffer + 4 * slab;
+	std::fill(buffer, buffer + 5 * slab, -1);
+
+	impl::sample_slab(f, lo, h, 0, nx, ny, below);
+
+	for(int z=0; z<res[2]; ++z) {
+		impl::sample_slab(f, lo, h, z+1, nx, ny, above);
+		const float* layers[2] = { below, above };
+
+		for(int x=0; x<res[0]; ++x)
+		for(int y=0; y<res[1]; ++y) {
+
+			//Classify corners
+			float values[8];
+			int mc_case = 0;
+			for(int c=0; c<8; ++c) {
+				values[c] = layers[c >> 2][(x + (c & 1)) * ny + y + ((c >> 1) & 1)];
+				if(values[c] < 0) {
+					mc_case |= 1 << c;
+				}
+			}
+
+			const int mask = table.edge_mask[mc_case];
+			if(mask == 0)
+				continue;
+			const Vector cell_lo = (Eigen::Array3f(x, y, z) * h.array() + lo.array()).matrix();
+
+			//Look up or create edge vertices
+			int verts[12];
+			for(int e=0; e<12; ++e) {
+				if(!(mask & (1 << e)))
+					continue;
+
+				const int a = impl::mc_edge_axis(e);
+				const int c0 = impl::mc_edge_corner0(e), c1 = impl::mc_edge_corner1(e);
+				const Eigen::Vector3i coord(x + (c0 & 1), y + ((c0 >> 1) & 1), z + (c0 >> 2));
+				const int idx = coord[0] * ny + coord[1];
+				int& slot = (a == 2) ? z_edges[idx] : xy_edges[c0 >> 2][a][idx];
+
+				if(slot < 0) {
+					const Vector p = (coord.cast<float>().array() * h.array() + lo.array()).matrix();
+					Eigen::Vector3f e_p(p);
+					e_p[a] += h[a];
+					const float t = values[c0] / (values[c0] - values[c1]);
+					const Eigen::Vector3f q = ((1.f-t)*p + t*e_p).eval();
+					slot = mesh.add_vertex(impl::make_vertex(attr, q, impl::mc_gradient(values, (q - cell_lo).array() / h.array(), h)));
+				}
+				verts[e] = slot;
+			}
+
+			//Emit triangles
+			const int8_t* tris = table.cases[mc_case].edges;
+			for(int i=0; tris[i] >= 0; i+=3) {
+				mesh.add_triangle(verts[tris[i]], verts[tris[i+1]], verts[tris[i+2]]);
+			}
+		}
+
+		//Advance a layer
+		std::swap(above, below);
+		std::swap(xy_edges[0][0], xy_edges[1][0]);
+		std::swap(xy_edges[0][1], xy_edges[1][1]);
+		std::fill(xy_edges[1][0], xy_edges[1][0] + slab, -1);
+		std::fill(xy_edges[1][1], xy_edges[1][1] + slab, -1);
+		std::fill(z_edges, z_edges + slab, -1);
+	}
+}
+
+};
+
+#endif
+
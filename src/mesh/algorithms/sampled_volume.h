@@ -0,0 +1,240 @@
+#ifndef MESH_SAMPLED_VOLUME_H
+#define MESH_SAMPLED_VOLUME_H
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+#include "mesh/core/trimesh.h"
+#include "mesh/algorithms/density.h"
+#include "mesh/algorithms/contour.h"
+
+//Pyramid leaves are (1 << SAMPLED_VOLUME_BLOCK_BITS)^3 cells
+#define SAMPLED_VOLUME_BLOCK_BITS	3
+
+namespace Mesh {
+
+/**
+ * A density sampled on the grid origin + (x,y,z) * spacing, for
+ * 0 <= x,y,z < points, together with a pyramid of the minimum and maximum
+ * sample over blocks of cells.
+ *
+ * Level 0 of the pyramid holds the range of every block of 8^3 cells
+ * (including the samples on its upper faces, so that it bounds every edge of
+ * the block), and each level above holds the range of 2^3 blocks of the
+ * level below, up to a single block.  The pyramid is built by sample, and
+ * must be rebuilt with update_pyramid after writing to values directly.
+ *
+ * To reproduce isocontour(mesh, f, attr, lo, hi, res) with isocontour_volume,
+ * sample f with origin lo - h, spacing h = (hi - lo) / res and res + 3 points.
+ */
+struct SampledVolume {
+
+	SampledVolume(
+		Eigen::Vector3f const& origin_,
+		Eigen::Vector3f const& spacing_,
+		Eigen::Vector3i const& points_) :
+		origin(origin_),
+		spacing(spacing_),
+		points(points_),
+		values(points_[0] * points_[1] * points_[2], 0.f) {
+		assert((points.array() >= 2).all());
+		update_pyramid();
+	}
+
+	///Index of the sample x,y,z in values, which is stored as rows along y
+	int index(int x, int y, int z) const {
+		return (z * points[0] + x) * points[1] + y;
+	}
+
+	float& at(int x, int y, int z) {
+		return values[index(x, y, z)];
+	}
+
+	float at(int x, int y, int z) const {
+		return values[index(x, y, z)];
+	}
+
+	///Samples f at every grid point, and rebuilds the pyramid
+	template<typename DensityFunc>
+	void sample(DensityFunc& f) {
+		const Eigen::Vector3f step(0, spacing[1], 0);
+		for(int z=0; z<points[2]; ++z)
+		for(int x=0; x<points[0]; ++x) {
+			const Eigen::Vector3f row = (Eigen::Array3f(x, 0, z) * spacing.array() + origin.array()).matrix();
+			impl::sample_row(f, row, step, points[1], &values[index(x, 0, z)]);
+		}
+		update_pyramid();
+	}
+
+	///Recomputes the block ranges from values
+	void update_pyramid() {
+		const int block = 1 << SAMPLED_VOLUME_BLOCK_BITS;
+
+		levels.clear();
+		level_size.clear();
+
+		//Leaf blocks
+		Eigen::Vector3i n;
+		for(int i=0; i<3; ++i)
+			n[i] = (points[i] - 2 + block) / block;
+		levels.push_back(std::vector<Eigen::Vector2f>(n[0] * n[1] * n[2]));
+		level_size.push_back(n);
+		for(int bz=0; bz<n[2]; ++bz)
+		for(int bx=0; bx<n[0]; ++bx)
+		for(int by=0; by<n[1]; ++by) {
+			const Eigen::Vector3i b_lo(bx * block, by * block, bz * block);
+			const Eigen::Vector3i b_hi = (b_lo.array() + block).min(points.array() - 1).matrix();
+			Eigen::Vector2f range(values[index(b_lo[0], b_lo[1], b_lo[2])], values[index(b_lo[0], b_lo[1], b_lo[2])]);
+			for(int z=b_lo[2]; z<=b_hi[2]; ++z)
+			for(int x=b_lo[0]; x<=b_hi[0]; ++x)
+			for(int y=b_lo[1]; y<=b_hi[1]; ++y) {
+				const float v = values[index(x, y, z)];
+				range[0] = std::min(range[0], v);
+				range[1] = std::max(range[1], v);
+			}
+			levels[0][(bz * n[0] + bx) * n[1] + by] = range;
+		}
+
+		//Merge 2^3 blocks per level until a single block is left
+		while(n.maxCoeff() > 1) {
+			const Eigen::Vector3i c = n;
+			for(int i=0; i<3; ++i)
+				n[i] = (c[i] + 1) / 2;
+			std::vector<Eigen::Vector2f> const& child = levels.back();
+			std::vector<Eigen::Vector2f> parent(n[0] * n[1] * n[2], Eigen::Vector2f(INFINITY, -INFINITY));
+			for(int z=0; z<c[2]; ++z)
+			for(int x=0; x<c[0]; ++x)
+			for(int y=0; y<c[1]; ++y) {
+				Eigen::Vector2f const& r = child[(z * c[0] + x) * c[1] + y];
+				Eigen::Vector2f& p = parent[((z/2) * n[0] + x/2) * n[1] + y/2];
+				p[0] = std::min(p[0], r[0]);
+				p[1] = std::max(p[1], r[1]);
+			}
+			levels.push_back(parent);
+			level_size.push_back(n);
+		}
+	}
+
+	///Range [min,max] of the samples in block coord of level
+	Eigen::Vector2f block_range(int level, Eigen::Vector3i const& coord) const {
+		Eigen::Vector3i const& n = level_size[level];
+		return levels[level][(coord[2] * n[0] + coord[0]) * n[1] + coord[1]];
+	}
+
+	///Trilinear interpolation of the samples, clamped to the grid
+	float operator()(Eigen::Vector3f const& p) const {
+		int c[3];
+		float t[3];
+		for(int i=0; i<3; ++i) {
+			const float u = std::min(std::max((p[i] - origin[i]) / spacing[i], 0.f), (float)(points[i] - 1));
+			c[i] = std::min((int)u, points[i] - 2);
+			t[i] = u - (float)c[i];
+		}
+		float result = 0.f;
+		for(int i=0; i<8; ++i) {
+			const float w =
+				((i&1) ? t[0] : 1.f - t[0]) *
+				((i&2) ? t[1] : 1.f - t[1]) *
+				((i&4) ? t[2] : 1.f - t[2]);
+			result += w * values[index(c[0] + (i&1), c[1] + ((i>>1)&1), c[2] + (i>>2))];
+		}
+		return result;
+	}
+
+	Eigen::Vector3f		origin, spacing;
+	Eigen::Vector3i		points;
+	std::vector<float>	values;
+
+	//Block ranges per level, stored like values, and the number of blocks per level
+	std::vector< std::vector<Eigen::Vector2f> >	levels;
+	std::vector<Eigen::Vector3i>					level_size;
+};
+
+/**
+ * Contours the isovalue level set of a sampled volume, like isocontour with
+ * f replaced by the samples minus isovalue.  The volume grid takes the place
+ * of the padded grid of isocontour, so the surface is left open where it
+ * leaves the volume.
+ *
+ * Only the blocks of the pyramid whose range contains isovalue are visited,
+ * so extracting another isovalue from the same volume costs time roughly
+ * proportional to the size of the output rather than of the volume.
+ */
+template<
+	typename Mesh,
+	typename AttributeFunc>
+void isocontour_volume(
+	Mesh& mesh,
+	SampledVolume const& volume,
+	AttributeFunc& attr,
+	float isovalue = 0.f) {
+
+	impl::ContourCells cells;
+
+	const int block = 1 << SAMPLED_VOLUME_BLOCK_BITS;
+	const Eigen::Vector3i res = volume.points - Eigen::Vector3i(1, 1, 1);
+	const Eigen::Vector3f& h = volume.spacing;
+	const int stride[3] = { volume.points[1], 1, volume.points[0] * volume.points[1] };
+
+	//To-visit stack of (level, block) nodes, from the root of the pyramid
+	std::vector< std::pair<int, Eigen::Vector3i> > to_visit;
+	to_visit.push_back(std::make_pair((int)volume.levels.size() - 1, Eigen::Vector3i(0, 0, 0)));
+
+	while(to_visit.size() > 0) {
+		const int level = to_visit.back().first;
+		const Eigen::Vector3i coord = to_visit.back().second;
+		to_visit.pop_back();
+
+		//Skip blocks which are safely above or below isovalue
+		const Eigen::Vector2f range = volume.block_range(level, coord);
+		if(range[0] - isovalue > FP_TOLERANCE || range[1] - isovalue < -FP_TOLERANCE)
+			continue;
+
+		//Subdivide
+		if(level > 0) {
+			Eigen::Vector3i const& n = volume.level_size[level - 1];
+			for(int i=0; i<8; ++i) {
+				const Eigen::Vector3i child(
+					2 * coord[0] + (i&1),
+					2 * coord[1] + ((i>>1)&1),
+					2 * coord[2] + (i>>2));
+				if((child.array() < n.array()).all()) {
+					to_visit.push_back(std::make_pair(level - 1, child));
+				}
+			}
+			continue;
+		}
+
+		//Find edge intersections inside the block
+		const Eigen::Vector3i b_lo = coord * block;
+		const Eigen::Vector3i b_hi = (b_lo.array() + block).min(res.array()).matrix();
+		for(int z=b_lo[2]; z<=b_hi[2]; ++z)
+		for(int x=b_lo[0]; x<=b_hi[0]; ++x)
+		for(int y=b_lo[1]; y<=b_hi[1]; ++y) {
+			const Eigen::Vector3i p_coord(x, y, z);
+			if((p_coord.array() >= res.array()).any())
+				continue;
+
+			const Eigen::Vector3f p = (p_coord.cast<float>().array() * h.array() + volume.origin.array()).matrix();
+			const int idx = volume.index(x, y, z);
+			const float c_f = volume.values[idx] - isovalue;
+			for(int e=0; e<3; ++e) {
+				if(p_coord[e] + 1 > b_hi[e])
+					continue;
+				cells.add_edge(p_coord, e, p, h[e], c_f, volume.values[idx + stride[e]] - isovalue);
+			}
+		}
+	}
+
+	cells.extract(mesh, attr, res);
+}
+
+};
+
+#endif
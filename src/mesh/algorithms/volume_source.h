@@ -0,0 +1,328 @@
+#ifndef MESH_VOLUME_SOURCE_H
+#define MESH_VOLUME_SOURCE_H
+
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Eigen/Core>
+
+#include "mesh/implementation/util.h"
+#include "mesh/core/trimesh.h"
+#include "mesh/algorithms/contour.h"
+#include "mesh/algorithms/contour_stream.h"
+#include "mesh/algorithms/sampled_volume.h"
+
+//Number of slabs ahead of the sweep which are requested from disk
+#define VOLUME_SOURCE_READ_AHEAD	4
+
+namespace Mesh {
+
+///Sample formats of a volume file
+enum VolumeType {
+	VOLUME_FLOAT32	= 0,
+	VOLUME_UINT16	= 1
+};
+
+namespace impl {
+
+	/**
+	 * Header of a raw volume file, which is followed by the samples.  Samples
+	 * are stored like SampledVolume::values, as z slabs of rows along y, and
+	 * integer samples stand for raw * scale + offset.
+	 */
+	struct VolumeHeader {
+		char		magic[8];
+		int32_t		points[3];
+		int32_t		type;
+		float		origin[3];
+		float		spacing[3];
+		float		scale;
+		float		offset;
+		char		reserved[8];
+	};
+};
+
+/**
+ * A sampled volume stored in a raw file, which is memory mapped rather than
+ * read, so that volumes larger than memory can be contoured.
+ *
+ * Slabs are read in order of increasing z with read_slab.  Each call asks the
+ * kernel to read the next VOLUME_SOURCE_READ_AHEAD slabs in the background,
+ * and releases the pages of slabs more than resident_slabs behind, so the
+ * resident set stays bounded and a sweep runs at about disk bandwidth.
+ *
+ * A file which is missing or does not have a valid header leaves the source
+ * closed (see is_open).
+ */
+struct VolumeSource {
+
+	VolumeSource(const char* path, int resident_slabs_ = 2) :
+		fd(-1),
+		size(0),
+		data(NULL),
+		resident_slabs(std::max(resident_slabs_, 1)),
+		released(0),
+		advised(0) {
+
+		fd = open(path, O_RDONLY);
+		if(fd < 0)
+			return;
+
+		impl::VolumeHeader header;
+		struct stat info;
+		if(	fstat(fd, &info) != 0 ||
+			pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+			memcmp(header.magic, "TMVOL1", 7) != 0 ||
+			(header.type != VOLUME_FLOAT32 && header.type != VOLUME_UINT16)) {
+			close();
+			return;
+		}
+
+		type = (VolumeType)header.type;
+		for(int i=0; i<3; ++i) {
+			points[i] = header.points[i];
+			origin[i] = header.origin[i];
+			spacing[i] = header.spacing[i];
+		}
+		scale = header.scale;
+		offset = header.offset;
+
+		//The sweeps index 5 slabs of crossings with an int
+		bool valid = (int64_t)points[0] * points[1] <= INT_MAX / 5;
+		for(int i=0; i<3; ++i)
+			valid = valid && points[i] >= 2 && std::isfinite(spacing[i]) && spacing[i] > 0.f;
+		if(!valid) {
+			close();
+			return;
+		}
+
+		//Compare without multiplying, which could overflow
+		slab_bytes = (size_t)points[0] * points[1] * sample_bytes();
+		size = (size_t)info.st_size;
+		if(	size < sizeof(header) ||
+			(size_t)points[2] > (size - sizeof(header)) / slab_bytes) {
+			close();
+			return;
+		}
+
+		void* ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if(ptr == MAP_FAILED) {
+			close();
+			return;
+		}
+		data = (unsigned char*)ptr;
+		madvise(data, size, MADV_SEQUENTIAL);
+	}
+
+	~VolumeSource() {
+		close();
+	}
+
+	bool is_open() const {
+		return data != NULL;
+	}
+
+	int sample_bytes() const {
+		return type == VOLUME_UINT16 ? 2 : 4;
+	}
+
+	/**
+	 * Converts the samples of slab z to floats in out, which must have room
+	 * for points[0] * points[1] values.
+	 */
+	void read_slab(int z, float* out) {
+		advise(z);
+
+		const int count = points[0] * points[1];
+		unsigned char const* slab = data + slab_start(z);
+		if(type == VOLUME_FLOAT32) {
+			memcpy(out, slab, count * sizeof(float));
+		}
+		else {
+			uint16_t const* raw = (uint16_t const*)slab;
+			for(int i=0; i<count; ++i)
+				out[i] = raw[i] * scale + offset;
+		}
+	}
+
+	/**
+	 * Writes volume to a raw volume file.  Integer formats store
+	 * round((v - offset) / scale), clamped to their range.  Returns false if
+	 * the file could not be written.
+	 */
+	static bool write(
+		const char* path,
+		SampledVolume const& volume,
+		VolumeType type = VOLUME_FLOAT32,
+		float scale = 1.f,
+		float offset = 0.f) {
+
+		FILE* file = fopen(path, "wb");
+		if(!file)
+			return false;
+
+		impl::VolumeHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "TMVOL1", 7);
+		header.type = type;
+		for(int i=0; i<3; ++i) {
+			header.points[i] = volume.points[i];
+			header.origin[i] = volume.origin[i];
+			header.spacing[i] = volume.spacing[i];
+		}
+		header.scale = scale;
+		header.offset = offset;
+		bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+		//Write a slab at a time
+		const int count = volume.points[0] * volume.points[1];
+		std::vector<uint16_t> raw(type == VOLUME_UINT16 ? count : 0);
+		for(int z=0; ok && z<volume.points[2]; ++z) {
+			float const* slab = &volume.values[volume.index(0, 0, z)];
+			if(type == VOLUME_FLOAT32) {
+				ok = fwrite(slab, sizeof(float), count, file) == (size_t)count;
+			}
+			else {
+				for(int i=0; i<count; ++i) {
+					const float v = std::floor((slab[i] - offset) / scale + 0.5f);
+					raw[i] = (uint16_t)std::min(std::max(v, 0.f), 65535.f);
+				}
+				ok = fwrite(&raw[0], sizeof(uint16_t), count, file) == (size_t)count;
+			}
+		}
+
+		return fclose(file) == 0 && ok;
+	}
+
+	Eigen::Vector3f		origin, spacing;
+	Eigen::Vector3i		points;
+	VolumeType			type;
+	float				scale, offset;
+
+private:
+
+	size_t slab_start(int z) const {
+		return sizeof(impl::VolumeHeader) + slab_bytes * z;
+	}
+
+	///Requests the slabs ahead of z and releases those far behind it
+	void advise(int z) {
+		const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+		const int ahead = std::min(z + 1 + VOLUME_SOURCE_READ_AHEAD, points[2]);
+		if(ahead > advised) {
+			const size_t start = slab_start(std::max(advised, z)) / page * page;
+			madvise(data + start, slab_start(ahead) - start, MADV_WILLNEED);
+			advised = ahead;
+		}
+
+		//Only whole pages below the resident slabs are dropped
+		if(z >= resident_slabs) {
+			const size_t end = slab_start(z - resident_slabs + 1) / page * page;
+			if(end > released) {
+				madvise(data + released, end - released, MADV_DONTNEED);
+				released = end;
+			}
+		}
+	}
+
+	void close() {
+		if(data) {
+			munmap(data, size);
+			data = NULL;
+		}
+		if(fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+
+	int				fd;
+	size_t			size, slab_bytes;
+	unsigned char*	data;
+	int				resident_slabs;
+	size_t			released;
+	int				advised;
+};
+
+namespace impl {
+
+	///Reads the slabs of a VolumeSource for contour_slabs, relative to isovalue
+	struct VolumeSlabs {
+		VolumeSlabs(VolumeSource& source_, float isovalue_) :
+			source(source_),
+			isovalue(isovalue_) {}
+
+		void operator()(int z, float* out) {
+			source.read_slab(z, out);
+			if(isovalue != 0.f) {
+				const int count = source.points[0] * source.points[1];
+				for(int i=0; i<count; ++i)
+					out[i] -= isovalue;
+			}
+		}
+
+		VolumeSource&	source;
+		float			isovalue;
+	};
+};
+
+/**
+ * Contours the isovalue level set of a volume file with a single pass over
+ * its slabs, using the sweep of isocontour_stream.  Produces the same surface
+ * as isocontour_volume on the SampledVolume the file was written from, but
+ * writes it to sink one slab at a time:  only two slabs of samples and the
+ * crossings and cells of the current layer are kept, so memory use is
+ * O(points[0] * points[1]) regardless of the size of the volume or of the
+ * output.  Cell vertices which are not used by any triangle are not emitted.
+ *
+ *  Sink implements the sink interface of mesh/algorithms/contour_stream.h
+ */
+template<
+	typename Sink,
+	typename AttributeFunc>
+void isocontour_volume_stream(
+	Sink& sink,
+	VolumeSource& source,
+	AttributeFunc& attr,
+	float isovalue = 0.f) {
+
+	if(!source.is_open())
+		return;
+
+	impl::VolumeSlabs slabs(source, isovalue);
+	const Eigen::Vector3i res = source.points - Eigen::Vector3i(1, 1, 1);
+	impl::contour_slabs(sink, slabs, attr, source.origin, source.spacing, res);
+}
+
+/**
+ * Contours a volume file into mesh with isocontour_volume_stream.  Memory use
+ * beyond that of mesh is O(points[0] * points[1]).
+ */
+template<
+	typename Mesh,
+	typename AttributeFunc>
+void isocontour_volume(
+	Mesh& mesh,
+	VolumeSource& source,
+	AttributeFunc& attr,
+	float isovalue = 0.f) {
+
+	MeshSink<Mesh> sink(mesh);
+	isocontour_volume_stream(sink, source, attr, isovalue);
+}
+
+};
+
+#endif
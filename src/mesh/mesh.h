@@ -10,8 +10,19 @@
 #include "mesh/core/trimesh.h"
 
 //Algorithms
+#include "mesh/algorithms/density.h"
+#include "mesh/algorithms/density_cache.h"
+#include "mesh/algorithms/density_overlay.h"
 #include "mesh/algorithms/connected_components.h"
 #include "mesh/algorithms/contour.h"
+#include "mesh/algorithms/contour_stream.h"
+#include "mesh/algorithms/contour_context.h"
+#include "mesh/algorithms/contour_lod.h"
+#include "mesh/algorithms/contour_heightfield.h"
+#include "mesh/algorithms/sampled_volume.h"
+#include "mesh/algorithms/volume_source.h"
+#include "mesh/algorithms/dual_contour.h"
+#include "mesh/algorithms/marching_cubes.h"
 #include "mesh/algorithms/repair.h"
 
 //Serialization
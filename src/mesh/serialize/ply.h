@@ -7,43 +7,170 @@
 
 #include <Eigen/Core>
 
+#include "mesh/core/attributes.h"
 #include "mesh/core/trimesh.h"
 
 namespace Mesh {
 
+/**
+ * Describes how a vertex type is written to a PLY file.
+ *
+ * The default writes the position attribute as 3 floats.  Other vertex types
+ * specialize this with the same members:
+ *
+ *	header	: Property lines of the vertex element
+ *	ascii	: Writes a vertex as one line of text
+ *	binary	: Writes a vertex in the order of the properties, in host byte order
+ */
+template<typename T> struct PlyVertexFormat {
+	static const char* header() {
+		return
+			"property float x\n"
+			"property float y\n"
+			"property float z\n";
+	}
+
+	static void ascii(FILE* fout, T const& v) {
+		Eigen::Vector3f const& p = PositionAttribute<T>().get(v);
+		fprintf(fout, "%f %f %f\n", p[0], p[1], p[2]);
+	}
+
+	static void binary(FILE* fout, T const& v) {
+		Eigen::Vector3f const& p = PositionAttribute<T>().get(v);
+		float buf[3] = { p[0], p[1], p[2] };
+		fwrite(buf, sizeof(float), 3, fout);
+	}
+};
+
+namespace impl {
+
+	template<typename VertexFormat>
+	void ply_header(
+		FILE* fout,
+		const char* format,
+		const char* comment,
+		int vcount,
+		int tcount,
+		const char* index_type) {
+
+		fprintf(fout, "ply\nformat %s 1.0\n", format);
+		if(comment)
+			fprintf(fout, "comment %s\n", comment);
+		fprintf(fout, "element vertex %d\n", vcount);
+		fputs(PlyVertexFormat<VertexFormat>::header(), fout);
+		fprintf(fout,
+			"element face %d\n"
+			"property list uchar %s vertex_indices\n"
+			"end_header\n",
+			tcount,
+			index_type);
+	}
+};
+
+/**
+ * Writes the index and vertex buffers of a mesh (see TriMesh::get_buffers) as
+ * an ASCII PLY file.  The comment, if any, is written to the header.
+ */
 template<typename VertexFormat>
 void ply_ascii_serialize(
 	FILE* fout,
-	TriMesh<VertexFormat> const& mesh) {
+	VertexFormat const* vbuffer,
+	int vcount,
+	int const* ibuffer,
+	int icount,
+	const char* comment = NULL) {
 
-	auto verts = mesh.verts();
-	auto tris = mesh.tris();
-
-	fprintf(fout, 
-		"ply\n"
-		"format ascii 1.0\n"
-		"element vertex %d\n"
-		"property float x\n"
-		"property float y\n"
-		"property float z\n"
-		"element face %d\n"
-		"property list uchar int vertex_index\n"
-		"end header\n",
-		(int)verts.size(),
-		(int)tris.size());
-	
-	for(int i=0; i<verts.size(); ++i) {
-		fprintf(fout, "%f %f %f\n", verts[i][0], verts[i][1], verts[i][2]);	
+	impl::ply_header<VertexFormat>(fout, "ascii", comment, vcount, icount / 3, "int");
+
+	for(int i=0; i<vcount; ++i) {
+		PlyVertexFormat<VertexFormat>::ascii(fout, vbuffer[i]);
+	}
+
+	for(int i=0; i<icount; i+=3) {
+		fprintf(fout, "3 %d %d %d\n", ibuffer[i], ibuffer[i+1], ibuffer[i+2]);
+	}
+}
+
+/**
+ * Writes the index and vertex buffers of a mesh as a binary PLY file in host
+ * byte order.  Indices are written as 16 bit integers when there are at most
+ * 65536 vertices.
+ */
+template<typename VertexFormat>
+void ply_binary_serialize(
+	FILE* fout,
+	VertexFormat const* vbuffer,
+	int vcount,
+	int const* ibuffer,
+	int icount,
+	const char* comment = NULL) {
+
+	const uint16_t order = 1;
+	const bool little_endian = *(const uint8_t*)&order == 1;
+	const bool short_indices = vcount <= 65536;
+	impl::ply_header<VertexFormat>(
+		fout,
+		little_endian ? "binary_little_endian" : "binary_big_endian",
+		comment,
+		vcount,
+		icount / 3,
+		short_indices ? "ushort" : "int");
+
+	for(int i=0; i<vcount; ++i) {
+		PlyVertexFormat<VertexFormat>::binary(fout, vbuffer[i]);
 	}
-	
-	for(int i=0; i<tris.size(); ++i) {
-		fprintf(fout, "%u %u %u\n", tris[i].v[0], tris[i].v[1], tris[i].v[2]);
+
+	const uint8_t count = 3;
+	for(int i=0; i<icount; i+=3) {
+		fwrite(&count, 1, 1, fout);
+		if(short_indices) {
+			uint16_t tri[3] = { (uint16_t)ibuffer[i], (uint16_t)ibuffer[i+1], (uint16_t)ibuffer[i+2] };
+			fwrite(tri, sizeof(uint16_t), 3, fout);
+		}
+		else {
+			fwrite(&ibuffer[i], sizeof(int), 3, fout);
+		}
 	}
 }
-	
-//TODO: Add more file serialization stuff here	
+
+/**
+ * Writes a mesh as an ASCII PLY file.  garbage_collect should be called first.
+ */
+template<typename VertexFormat>
+void ply_ascii_serialize(
+	FILE* fout,
+	TriMesh<VertexFormat> const& mesh) {
+
+	std::vector<VertexFormat> const& verts = mesh.vertices();
+	std::vector<Triangle> const& tris = mesh.triangles();
+	ply_ascii_serialize(
+		fout,
+		verts.empty() ? NULL : &verts[0],
+		(int)verts.size(),
+		tris.empty() ? NULL : tris[0].v,
+		3 * (int)tris.size());
+}
+
+/**
+ * Writes a mesh as a binary PLY file.  garbage_collect should be called first.
+ */
+template<typename VertexFormat>
+void ply_binary_serialize(
+	FILE* fout,
+	TriMesh<VertexFormat> const& mesh) {
+
+	std::vector<VertexFormat> const& verts = mesh.vertices();
+	std::vector<Triangle> const& tris = mesh.triangles();
+	ply_binary_serialize(
+		fout,
+		verts.empty() ? NULL : &verts[0],
+		(int)verts.size(),
+		tris.empty() ? NULL : tris[0].v,
+		3 * (int)tris.size());
+}
+
+//TODO: Add more file serialization stuff here
 
 };
 
 #endif
-
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <math.h>
+#include <string.h>
 
 static int64_t grad3[12][3] = {
 {1,1,0},
@@ -19,37 +21,109 @@ static int64_t grad3[12][3] = {
 {0,1,-1},
 {0,-1,-1}};
 
-int64_t seed = 0;
-void setNoiseSeed(int64_t i)
+static void build_permutation(NoiseContext* ctx);
+
+NoiseContext::NoiseContext(int64_t seed_, NoiseHash hash_, int period_) :
+	seed(seed_),
+	hash(hash_),
+	period(256)
 {
-	seed = i;
+	//Round the period down to a power of two
+	while(period > 1 && period > period_)
+		period >>= 1;
+	build_permutation(this);
 }
 
-int32_t pseudorand(int32_t a)
+NoiseContext* defaultNoiseContext()
 {
-	a += seed;
-    a = (a ^ 61) ^ (a >> 16);
-    a = a + (a << 3);
-    a = a ^ (a >> 4);
-    a = a * 0x27d4eb2d;
-    a = a ^ (a >> 15);
-    return a;
+	static NoiseContext context;
+	return &context;
 }
 
-int64_t pseudorand_var(int64_t i, ...)
+void setNoiseSeed(NoiseContext* ctx, int64_t i)
+{
+	ctx->seed = i;
+	build_permutation(ctx);
+}
+
+void setNoiseHash(NoiseContext* ctx, NoiseHash hash)
+{
+	ctx->hash = hash;
+	build_permutation(ctx);
+}
+
+//pseudorand with the wraparound of its int32_t arithmetic made explicit, so
+//that it can be inlined into the hashes below
+static inline int32_t mix(NoiseContext const* ctx, int32_t a)
+{
+	uint32_t u = (uint32_t)a + (uint32_t)ctx->seed;
+	u = (u ^ 61) ^ (uint32_t)((int32_t)u >> 16);
+	u = u + (u << 3);
+	u = u ^ (uint32_t)((int32_t)u >> 4);
+	u = u * 0x27d4eb2d;
+	u = u ^ (uint32_t)((int32_t)u >> 15);
+	return (int32_t)u;
+}
+
+int32_t pseudorand(NoiseContext const* ctx, int32_t a)
+{
+	return mix(ctx, a);
+}
+
+int64_t pseudorand_var(NoiseContext const* ctx, int64_t i, ...)
 {
 	va_list args;
 	va_start(args, i);
 	
 	int64_t retval = 0;
 	for(int64_t x = 0; x < i; x++)
-		retval = pseudorand(retval + va_arg(args, int64_t));
+		retval = pseudorand(ctx, retval + va_arg(args, int64_t));
 	
 	va_end(args);
 	
 	return retval;
 }
 
+static void build_permutation(NoiseContext* ctx)
+{
+	uint8_t* perm = ctx->perm;
+	const int period = ctx->period;
+	for(int i = 0; i < period; i++)
+		perm[i] = i;
+	for(int i = period - 1; i > 0; i--)
+	{
+		int j = (uint32_t)mix(ctx, i) % (i + 1);
+		uint8_t tmp = perm[i];
+		perm[i] = perm[j];
+		perm[j] = tmp;
+	}
+	for(int i = 0; i < 512; i++)
+	{
+		perm[i] = perm[i & (period - 1)];
+		ctx->perm_mod12[i] = perm[i] % 12;
+	}
+}
+
+//Gradient index of a lattice point, for coordinates in [0, 256].  The
+//pseudorand hash is pseudorand_var(n, x, y[, z]) % 12 without the varargs.
+static inline int64_t gradient2D(NoiseContext const* ctx, int64_t x, int64_t y)
+{
+	if(ctx->hash == NOISE_HASH_TABLE)
+		return ctx->perm_mod12[x + ctx->perm[y]];
+	
+	int64_t gi = mix(ctx, mix(ctx, x) + y) % 12;
+	return gi < 0 ? gi + 12 : gi;
+}
+
+static inline int64_t gradient3D(NoiseContext const* ctx, int64_t x, int64_t y, int64_t z)
+{
+	if(ctx->hash == NOISE_HASH_TABLE)
+		return ctx->perm_mod12[x + ctx->perm[y + ctx->perm[z]]];
+	
+	int64_t gi = mix(ctx, mix(ctx, mix(ctx, x) + y) + z) % 12;
+	return gi < 0 ? gi + 12 : gi;
+}
+
 //calculate the floor of a float
 int64_t fastfloor(float x)
 {
@@ -66,9 +140,9 @@ float dot3D(int64_t g[], float x, float y, float z)
 	return g[0]*x + g[1]*y + g[2]*z;
 }
 
-float contrib1D(int64_t xco, int64_t yco, float x, float y)
+float contrib1D(NoiseContext const* ctx, int64_t xco, int64_t yco, float x, float y)
 {
-	int64_t gi = (pseudorand(xco) % 3) - 1;
+	int64_t gi = (pseudorand(ctx, xco) % 3) - 1;
 	float t = 0.5 - x*x;
 	
 	if(t < 0)
@@ -78,9 +152,9 @@ float contrib1D(int64_t xco, int64_t yco, float x, float y)
 	return t * t * gi * x;
 }
 
-float contrib2D(int64_t xco, int64_t yco, float x, float y)
+float contrib2D(NoiseContext const* ctx, int64_t xco, int64_t yco, float x, float y)
 {
-	int64_t gi = pseudorand_var(2, xco, yco) % 12;
+	int64_t gi = gradient2D(ctx, xco, yco);
 	float t = 0.5 - x*x - y*y;
 	
 	if(t < 0)
@@ -90,17 +164,30 @@ float contrib2D(int64_t xco, int64_t yco, float x, float y)
 	return t * t * dot2D(grad3[gi], x, y);
 }
 
-float contrib3D(int64_t xco, int64_t yco, int64_t zco, float x, float y, float z)
+//Adds the derivative of the contribution to gradient, if it is not NULL
+float contrib3D(NoiseContext const* ctx, int64_t xco, int64_t yco, int64_t zco, float x, float y, float z, float* gradient = NULL)
 {
-	int64_t gi = pseudorand_var(3, xco, yco, zco) % 12;
+	int64_t gi = gradient3D(ctx, xco, yco, zco);
 	
 	float t = 0.6 - x*x - y*y - z*z;
 	
 	if(t < 0)
 		return 0.0;
 	
+	float t1 = t;
 	t *= t;
-	return t * t * dot3D(grad3[gi], x, y, z);
+	float dot = dot3D(grad3[gi], x, y, z);
+	
+	//d/dx of t^4 * (g . x) = t^4 * g - 8 * t^3 * (g . x) * x
+	if(gradient)
+	{
+		float w = 8 * t * t1 * dot;
+		gradient[0] += t * t * grad3[gi][0] - w * x;
+		gradient[1] += t * t * grad3[gi][1] - w * y;
+		gradient[2] += t * t * grad3[gi][2] - w * z;
+	}
+	
+	return t * t * dot;
 }
 
 // 1D simplex noise
@@ -140,7 +227,7 @@ float simplexNoise1D(float xin, float yin, int64_t octaves)
 }
 
 // 2D simplex noise
-float simplexNoise2D(float xin, float yin, int64_t octaves)
+float simplexNoise2D(NoiseContext const* ctx, float xin, float yin, int64_t octaves)
 {
 	//base case
 	if(octaves <= 0)
@@ -189,9 +276,9 @@ float simplexNoise2D(float xin, float yin, int64_t octaves)
 	
 	// Calculate the contribution from the three corners
 	float retval = 0;
-	retval += contrib2D(ii, jj, x0, y0);
-	retval += contrib2D(ii + i1, jj + j1, x1, y1);
-	retval += contrib2D(ii + 1, jj + 1, x2, y2);
+	retval += contrib2D(ctx, ii, jj, x0, y0);
+	retval += contrib2D(ctx, ii + i1, jj + j1, x1, y1);
+	retval += contrib2D(ctx, ii + 1, jj + 1, x2, y2);
 	
 	//scale the output by 17.5 and add .25 so that it returns values in the interval [0, .5]
 	retval *= 17.5;
@@ -199,14 +286,12 @@ float simplexNoise2D(float xin, float yin, int64_t octaves)
 	
 	// Add contributions from each corner to get the final noise value.
 	// The result is scaled to return values in the interval [-1,1].
-	return retval + (.5 * simplexNoise2D(xin * 2, yin * 2, octaves - 1));
+	return retval + (.5 * simplexNoise2D(ctx, xin * 2, yin * 2, octaves - 1));
 }
 
-float simplexNoise3D(float xin, float yin, float zin, int64_t octaves)
+//First octave of simplexNoise3D, adding its derivative to gradient if it is not NULL
+static float simplexOctave3D(NoiseContext const* ctx, float xin, float yin, float zin, float* gradient)
 {
-	if(octaves <= 0)
-		return 0;
-	
 	// Skew the input space to determine which simplex cell we're in
 	const float F3 = 1.0/3.0;
 	const float G3 = 1.0/6.0; // Very nice and simple unskew factor, too
@@ -260,13 +345,643 @@ float simplexNoise3D(float xin, float yin, float zin, int64_t octaves)
 	int64_t kk = k & 255;
 
 	float retval = 0;
-	retval += contrib3D(ii   , jj   , kk   , x0, y0, z0);
-	retval += contrib3D(ii+i1, jj+j1, kk+k1, x1, y1, z1);
-	retval += contrib3D(ii+i2, jj+j2, kk+k2, x2, y2, z2);
-	retval += contrib3D(ii+1 , jj+1 , kk+1 , x3, y3, z3);
+	float g[3] = {0, 0, 0};
+	float* dg = gradient ? g : NULL;
+	retval += contrib3D(ctx, ii   , jj   , kk   , x0, y0, z0, dg);
+	retval += contrib3D(ctx, ii+i1, jj+j1, kk+k1, x1, y1, z1, dg);
+	retval += contrib3D(ctx, ii+i2, jj+j2, kk+k2, x2, y2, z2, dg);
+	retval += contrib3D(ctx, ii+1 , jj+1 , kk+1 , x3, y3, z3, dg);
 	
 	retval *= 8.0;
 	retval += .25;
 	
-	return retval + (.5 * simplexNoise3D(xin * 2, yin * 2, zin * 2, octaves - 1));
+	if(gradient)
+	{
+		gradient[0] += 8 * g[0];
+		gradient[1] += 8 * g[1];
+		gradient[2] += 8 * g[2];
+	}
+	
+	return retval;
+}
+
+float simplexNoise3D(NoiseContext const* ctx, float xin, float yin, float zin, int64_t octaves)
+{
+	if(octaves <= 0)
+		return 0;
+	
+	return simplexOctave3D(ctx, xin, yin, zin, NULL) + (.5 * simplexNoise3D(ctx, xin * 2, yin * 2, zin * 2, octaves - 1));
+}
+
+//Octave o is scaled by 2^-o in value and 2^o in position, so the octaves'
+//derivatives are summed unscaled
+float simplexNoise3D_grad(NoiseContext const* ctx, float xin, float yin, float zin, int64_t octaves, float* gradient)
+{
+	gradient[0] = 0;
+	gradient[1] = 0;
+	gradient[2] = 0;
+	if(octaves <= 0)
+		return 0;
+	
+	float rest = simplexNoise3D_grad(ctx, xin * 2, yin * 2, zin * 2, octaves - 1, gradient);
+	return simplexOctave3D(ctx, xin, yin, zin, gradient) + (.5 * rest);
+}
+
+//Every octave of simplexNoise2D and simplexNoise3D lies in [0, .5] before it is
+//scaled:  the contributions of the corners of a simplex sum to at most 0.01426
+//in magnitude in 2D and 0.03058 in 3D, giving .25 +- .2495 and .25 +- .245
+static void octave_range(int64_t octaves, float* min, float* max)
+{
+	*min = 0;
+	*max = 0;
+	
+	float amplitude = .5;
+	for(int64_t o = 0; o < octaves; o++)
+	{
+		*max += amplitude;
+		amplitude *= .5;
+	}
+}
+
+void simplexNoise2D_range(int64_t octaves, float* min, float* max)
+{
+	octave_range(octaves, min, max);
+}
+
+void simplexNoise3D_range(int64_t octaves, float* min, float* max)
+{
+	octave_range(octaves, min, max);
+}
+
+//Bound on the slope of one octave of simplexNoise3D, from the slope of the
+//contributions of the corners of a simplex (3.04, with some margin)
+#define NOISE3D_LIPSCHITZ 3.1
+
+//Allowance for the jumps of an octave across the faces of the simplices,
+//which the corners outside a simplex cause (their kernels reach past it).
+//A jump is below .0016, and a box small enough to use the slope bound for
+//crosses a few faces between its center and any point.
+#define NOISE3D_JUMP .015
+
+//Period of the lattice coordinates:  they wrap to [0, 256) before hashing,
+//and fastfloor rounds 0 down to -1, so an octave jumps by up to about .1 on
+//the planes where a skewed coordinate (x + s, y + s or z + s) is a multiple
+//of it, 0 included
+#define NOISE3D_WRAP 256
+
+//True when the skewed coordinates of the box [lo,hi] reach a multiple of
+//NOISE3D_WRAP on some axis, with some margin for rounding
+static bool crosses_wrap(float const lo[3], float const hi[3])
+{
+	float slo = (lo[0] + lo[1] + lo[2]) * (1.0 / 3.0);
+	float shi = (hi[0] + hi[1] + hi[2]) * (1.0 / 3.0);
+	for(int i = 0; i < 3; i++)
+	{
+		float a = lo[i] + slo, b = hi[i] + shi;
+		float margin = 1e-3 + 1e-5 * (fabsf(a) + fabsf(b));
+		if(ceilf((a - margin) / NOISE3D_WRAP) * NOISE3D_WRAP <= b + margin)
+			return true;
+	}
+	return false;
+}
+
+void simplexNoise3D_bounds(
+	NoiseContext const* ctx,
+	float xlo, float ylo, float zlo,
+	float xhi, float yhi, float zhi,
+	int64_t octaves, float* min, float* max)
+{
+	float cx = .5 * (xlo + xhi), cy = .5 * (ylo + yhi), cz = .5 * (zlo + zhi);
+	float lo3[3] = {xlo, ylo, zlo}, hi3[3] = {xhi, yhi, zhi};
+	float radius = .5 * sqrtf((xhi-xlo)*(xhi-xlo) + (yhi-ylo)*(yhi-ylo) + (zhi-zlo)*(zhi-zlo));
+	
+	//Octave o is scaled by 2^-o and has 2^o times the slope, so its slope is
+	//the same as that of the first one, while its range halves.  Use the
+	//slope bound around the center for the octaves where it is tighter, and
+	//whose box does not reach the planes where the lattice wraps.
+	float spread = NOISE3D_LIPSCHITZ * radius;
+	
+	*min = 0;
+	*max = 0;
+	float amplitude = 1;
+	for(int64_t o = 0; o < octaves; o++)
+	{
+		float lo = 0, hi = .5 * amplitude;
+		float octave_spread = spread + NOISE3D_JUMP * amplitude;
+		if(octave_spread < .25 * amplitude && !crosses_wrap(lo3, hi3))
+		{
+			float c = amplitude * simplexNoise3D(ctx, cx, cy, cz, 1);
+			lo = fmaxf(lo, c - octave_spread);
+			hi = fminf(hi, c + octave_spread);
+		}
+		*min += lo;
+		*max += hi;
+		
+		cx *= 2;
+		cy *= 2;
+		cz *= 2;
+		for(int i = 0; i < 3; i++)
+		{
+			lo3[i] *= 2;
+			hi3[i] *= 2;
+		}
+		amplitude *= .5;
+	}
+}
+
+/*
+ * Batched 3D simplex noise.
+ *
+ * The kernel below is written once with GCC vector extensions, and inlined
+ * into functions compiled for SSE4.1 (4 lanes) and AVX2 (8 lanes).  The CPU
+ * is checked once, on the first call, and machines with neither fall back to
+ * the scalar code.  Every step follows simplexNoise3D, except that the few
+ * intermediates it computes in double precision are computed in float.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+typedef float		vfloat4		__attribute__((vector_size(16)));
+typedef int32_t		vint4		__attribute__((vector_size(16)));
+typedef uint32_t	vuint4		__attribute__((vector_size(16)));
+typedef uint64_t	vuint64x4	__attribute__((vector_size(32)));
+
+typedef float		vfloat8		__attribute__((vector_size(32)));
+typedef int32_t		vint8		__attribute__((vector_size(32)));
+typedef uint32_t	vuint8		__attribute__((vector_size(32)));
+typedef uint64_t	vuint64x8	__attribute__((vector_size(64)));
+
+//pseudorand on every lane
+template<typename I, typename U>
+static inline __attribute__((always_inline)) void hash_lanes(U& a, U const& seed32)
+{
+	a += seed32;
+	a = (a ^ 61) ^ (U)((I)a >> 16);
+	a = a + (a << 3);
+	a = a ^ (U)((I)a >> 4);
+	a = a * 0x27d4eb2d;
+	a = a ^ (U)((I)a >> 15);
+}
+
+//Contribution of the corner (cx,cy,cz) at offset (x,y,z), like contrib3D
+template<typename F, typename I, typename U, typename U64>
+static inline __attribute__((always_inline)) void contrib_lanes(
+	U const& cx, U const& cy, U const& cz,
+	F const& x, F const& y, F const& z,
+	U const& seed32, NoiseContext const* ctx, F& sum)
+{
+	U gi;
+	if(ctx->hash == NOISE_HASH_TABLE)
+	{
+		//No gathers with vector extensions, so look the table up per lane
+		for(int l = 0; l < (int)(sizeof(U) / sizeof(uint32_t)); l++)
+			gi[l] = ctx->perm_mod12[cx[l] + ctx->perm[cy[l] + ctx->perm[cz[l]]]];
+	}
+	else
+	{
+		//pseudorand_var(3, cx, cy, cz)
+		U h = cx;
+		hash_lanes<I, U>(h, seed32);
+		h += cy;
+		hash_lanes<I, U>(h, seed32);
+		h += cz;
+		hash_lanes<I, U>(h, seed32);
+		
+		//Floored h % 12, from the unsigned remainder and 2^32 % 12 == 4
+		U q = __builtin_convertvector((__builtin_convertvector(h, U64) * 0xAAAAAAABULL) >> 35, U);
+		U m = h - q * 12;
+		I negative = (I)h < 0;
+		gi = negative ? (m >= 4 ? m - 4 : m + 8) : m;
+	}
+	
+	//grad3[gi] has two nonzero components, chosen by gi / 4 and negated by the low bits
+	F u = (I)(gi >= 8) ? y : x;
+	F v = (I)(gi < 4) ? y : z;
+	u = (F)((U)u ^ ((gi & 1) << 31));
+	v = (F)((U)v ^ ((gi & 2) << 30));
+	
+	F t = 0.6f - x*x - y*y - z*z;
+	t = t < 0 ? (F){} : t;
+	t *= t;
+	sum += t * t * (u + v);
+}
+
+//floor as computed by fastfloor
+template<typename F, typename I>
+static inline __attribute__((always_inline)) void floor_lanes(F const& v, I& result)
+{
+	I t = __builtin_convertvector(v, I);
+	result = v > 0 ? t : t - 1;
+}
+
+template<typename F, typename I, typename U, typename U64>
+static inline __attribute__((always_inline)) void noise_lanes(
+	NoiseContext const* ctx, F const& xin, F const& yin, F const& zin, int64_t octaves, F& result)
+{
+	const float F3 = 1.0/3.0;
+	const float G3 = 1.0/6.0;
+	const U seed32 = (U){} + (uint32_t)ctx->seed;
+	
+	//Sum the octaves from the last one, as the recursion of simplexNoise3D does
+	result = (F){};
+	for(int64_t o = octaves - 1; o >= 0; o--)
+	{
+		const float scale = (float)((int64_t)1 << o);
+		F xs = xin * scale, ys = yin * scale, zs = zin * scale;
+		
+		F s = (xs+ys+zs)*F3;
+		I i, j, k;
+		floor_lanes<F, I>(xs+s, i);
+		floor_lanes<F, I>(ys+s, j);
+		floor_lanes<F, I>(zs+s, k);
+		F t = __builtin_convertvector(i+j+k, F)*G3;
+		F x0 = xs - (__builtin_convertvector(i, F) - t);
+		F y0 = ys - (__builtin_convertvector(j, F) - t);
+		F z0 = zs - (__builtin_convertvector(k, F) - t);
+		
+		//Simplex corner offsets, from the branches of simplexNoise3D
+		I xy = x0 >= y0, yz = y0 >= z0, xz = x0 >= z0;
+		I i1 = (xy & (yz | xz)) & 1;
+		I j1 = (~xy & yz) & 1;
+		I k1 = (~yz & ~(xy & xz)) & 1;
+		I i2 = (xy | (yz & xz)) & 1;
+		I j2 = (~xy | yz) & 1;
+		I k2 = (~yz | (~xy & ~xz)) & 1;
+		
+		U ii = (U)i & 255, jj = (U)j & 255, kk = (U)k & 255;
+		
+		F sum = (F){};
+		contrib_lanes<F, I, U, U64>(ii, jj, kk, x0, y0, z0, seed32, ctx, sum);
+		contrib_lanes<F, I, U, U64>(ii + (U)i1, jj + (U)j1, kk + (U)k1,
+			x0 - __builtin_convertvector(i1, F) + G3,
+			y0 - __builtin_convertvector(j1, F) + G3,
+			z0 - __builtin_convertvector(k1, F) + G3, seed32, ctx, sum);
+		contrib_lanes<F, I, U, U64>(ii + (U)i2, jj + (U)j2, kk + (U)k2,
+			x0 - __builtin_convertvector(i2, F) + 2.0f*G3,
+			y0 - __builtin_convertvector(j2, F) + 2.0f*G3,
+			z0 - __builtin_convertvector(k2, F) + 2.0f*G3, seed32, ctx, sum);
+		contrib_lanes<F, I, U, U64>(ii + 1, jj + 1, kk + 1,
+			x0 - 1.0f + 3.0f*G3,
+			y0 - 1.0f + 3.0f*G3,
+			z0 - 1.0f + 3.0f*G3, seed32, ctx, sum);
+		
+		result = (sum * 8.0f + .25f) + .5f * result;
+	}
+}
+
+template<typename F, typename I, typename U, typename U64>
+static inline __attribute__((always_inline)) void noise_batch(
+	NoiseContext const* ctx, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	const int width = sizeof(F) / sizeof(float);
+	for(int start = 0; start < n; start += width)
+	{
+		//The last block is padded with zeros
+		const int count = n - start < width ? n - start : width;
+		F xv = (F){}, yv = (F){}, zv = (F){}, result;
+		memcpy(&xv, x + start, count * sizeof(float));
+		memcpy(&yv, y + start, count * sizeof(float));
+		memcpy(&zv, z + start, count * sizeof(float));
+		noise_lanes<F, I, U, U64>(ctx, xv, yv, zv, octaves, result);
+		memcpy(out + start, &result, count * sizeof(float));
+	}
+}
+
+__attribute__((target("sse4.1")))
+static void simplexNoise3D_sse41(NoiseContext const* ctx, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	noise_batch<vfloat4, vint4, vuint4, vuint64x4>(ctx, x, y, z, out, n, octaves);
+}
+
+__attribute__((target("avx2")))
+static void simplexNoise3D_avx2(NoiseContext const* ctx, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	noise_batch<vfloat8, vint8, vuint8, vuint64x8>(ctx, x, y, z, out, n, octaves);
+}
+
+#endif
+
+static void simplexNoise3D_scalar(NoiseContext const* ctx, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	for(int i = 0; i < n; i++)
+		out[i] = simplexNoise3D(ctx, x[i], y[i], z[i], octaves);
+}
+
+typedef void (*NoiseBatchFunc)(NoiseContext const*, const float*, const float*, const float*, float*, int, int64_t);
+
+static NoiseBatchFunc select_noise_batch()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return simplexNoise3D_avx2;
+	if(__builtin_cpu_supports("sse4.1"))
+		return simplexNoise3D_sse41;
+#endif
+	return simplexNoise3D_scalar;
+}
+
+void simplexNoise3D_batch(NoiseContext const* ctx, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	static const NoiseBatchFunc func = select_noise_batch();
+	func(ctx, x, y, z, out, n, octaves);
+}
+
+/*
+ * Tiled 3D simplex noise.
+ *
+ * The first octave of a periodic context is sampled over one period, and
+ * every octave is read from those samples by trilinear interpolation, octave
+ * o at 2^o times the coordinates.  The batched sampler uses the same vector
+ * kernels and dispatch as simplexNoise3D_batch.
+ */
+
+//The trilinear interpolation error of one octave is below
+//NOISE_TILE_CURVATURE * h^2 + NOISE_TILE_JUMP for sample spacing h:  its
+//second derivatives are bounded (the error measured over 10^6 points is at
+//most 2.1 h^2), except across the faces of the simplices, where it jumps by
+//less than NOISE_TILE_JUMP
+#define NOISE_TILE_CURVATURE	2.5
+#define NOISE_TILE_JUMP			.0016
+
+NoiseTiles::NoiseTiles(NoiseContext const* ctx, int resolution_) :
+	context(ctx),
+	resolution(2),
+	period(3 * ctx->period),
+	scale(0),
+	samples(NULL)
+{
+	//Only the table hash is periodic
+	if(ctx->hash != NOISE_HASH_TABLE)
+		return;
+	
+	while(resolution < resolution_ && resolution < 1024)
+		resolution <<= 1;
+	scale = resolution / period;
+	
+	const int n = resolution;
+	samples = new float[n * n * n];
+	float* x = new float[3 * n];
+	float* y = x + n;
+	float* z = y + n;
+	for(int i = 0; i < n; i++)
+		x[i] = i / scale;
+	for(int k = 0; k < n; k++)
+	{
+		for(int j = 0; j < n; j++)
+		{
+			for(int i = 0; i < n; i++)
+			{
+				y[i] = j / scale;
+				z[i] = k / scale;
+			}
+			simplexNoise3D_batch(ctx, x, y, z, samples + n * (j + n * k), n, 1);
+		}
+	}
+	delete[] x;
+}
+
+NoiseTiles::~NoiseTiles()
+{
+	delete[] samples;
+}
+
+//One octave of tiled noise, before it is scaled
+static inline float tile_octave(NoiseTiles const* tiles, float x, float y, float z)
+{
+	const int n = tiles->resolution, m = n - 1;
+	float u = x * tiles->scale, v = y * tiles->scale, w = z * tiles->scale;
+	int i = (int)floorf(u), j = (int)floorf(v), k = (int)floorf(w);
+	float fx = u - i, fy = v - j, fz = w - k;
+	
+	int x0 = i & m, x1 = (i + 1) & m;
+	int y0 = (j & m) * n, y1 = ((j + 1) & m) * n;
+	int z0 = (k & m) * n * n, z1 = ((k + 1) & m) * n * n;
+	const float* s = tiles->samples;
+	
+	float c00 = s[x0+y0+z0] + fx * (s[x1+y0+z0] - s[x0+y0+z0]);
+	float c10 = s[x0+y1+z0] + fx * (s[x1+y1+z0] - s[x0+y1+z0]);
+	float c01 = s[x0+y0+z1] + fx * (s[x1+y0+z1] - s[x0+y0+z1]);
+	float c11 = s[x0+y1+z1] + fx * (s[x1+y1+z1] - s[x0+y1+z1]);
+	float c0 = c00 + fy * (c10 - c00);
+	float c1 = c01 + fy * (c11 - c01);
+	return c0 + fz * (c1 - c0);
+}
+
+float simplexNoise3D_tiled(NoiseTiles const* tiles, float xin, float yin, float zin, int64_t octaves)
+{
+	if(!tiles->samples)
+		return simplexNoise3D(tiles->context, xin, yin, zin, octaves);
+	
+	float result = 0;
+	for(int64_t o = octaves - 1; o >= 0; o--)
+	{
+		const float scale = (float)((int64_t)1 << o);
+		result = tile_octave(tiles, xin * scale, yin * scale, zin * scale) + .5f * result;
+	}
+	return result;
+}
+
+float simplexNoise3D_tiled_error(NoiseTiles const* tiles, int64_t octaves)
+{
+	if(!tiles->samples)
+		return 0;
+	
+	const float h = 1 / tiles->scale;
+	const float octave_error = NOISE_TILE_CURVATURE * h * h + NOISE_TILE_JUMP;
+	
+	float error = 0, amplitude = 1;
+	for(int64_t o = 0; o < octaves; o++)
+	{
+		error += amplitude * octave_error;
+		amplitude *= .5;
+	}
+	return error;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+//No gathers with vector extensions, so load the lanes one by one
+static inline __attribute__((always_inline)) void gather_lanes(const float* s, vint4 const& index, vfloat4& result)
+{
+	result = (vfloat4){s[index[0]], s[index[1]], s[index[2]], s[index[3]]};
+}
+
+static inline __attribute__((always_inline)) void gather_lanes(const float* s, vint8 const& index, vfloat8& result)
+{
+	result = (vfloat8){
+		s[index[0]], s[index[1]], s[index[2]], s[index[3]],
+		s[index[4]], s[index[5]], s[index[6]], s[index[7]]};
+}
+
+template<typename F, typename I>
+static inline __attribute__((always_inline)) void tiled_lanes(
+	NoiseTiles const* tiles, F const& xin, F const& yin, F const& zin, int64_t octaves, F& result)
+{
+	const int n = tiles->resolution, m = n - 1;
+	const float* s = tiles->samples;
+	
+	result = (F){};
+	for(int64_t o = octaves - 1; o >= 0; o--)
+	{
+		const float scale = tiles->scale * (float)((int64_t)1 << o);
+		F u = xin * scale, v = yin * scale, w = zin * scale;
+		
+		//floor, rounding the truncated values of negative lanes down
+		I i = __builtin_convertvector(u, I);
+		I j = __builtin_convertvector(v, I);
+		I k = __builtin_convertvector(w, I);
+		i += (I)(__builtin_convertvector(i, F) > u);
+		j += (I)(__builtin_convertvector(j, F) > v);
+		k += (I)(__builtin_convertvector(k, F) > w);
+		F fx = u - __builtin_convertvector(i, F);
+		F fy = v - __builtin_convertvector(j, F);
+		F fz = w - __builtin_convertvector(k, F);
+		
+		I x0 = i & m, x1 = (i + 1) & m;
+		I y0 = (j & m) * n, y1 = ((j + 1) & m) * n;
+		I z0 = (k & m) * (n * n), z1 = ((k + 1) & m) * (n * n);
+		
+		F s000, s100, s010, s110, s001, s101, s011, s111;
+		gather_lanes(s, x0 + y0 + z0, s000);
+		gather_lanes(s, x1 + y0 + z0, s100);
+		gather_lanes(s, x0 + y1 + z0, s010);
+		gather_lanes(s, x1 + y1 + z0, s110);
+		gather_lanes(s, x0 + y0 + z1, s001);
+		gather_lanes(s, x1 + y0 + z1, s101);
+		gather_lanes(s, x0 + y1 + z1, s011);
+		gather_lanes(s, x1 + y1 + z1, s111);
+		
+		F c00 = s000 + fx * (s100 - s000);
+		F c10 = s010 + fx * (s110 - s010);
+		F c01 = s001 + fx * (s101 - s001);
+		F c11 = s011 + fx * (s111 - s011);
+		F c0 = c00 + fy * (c10 - c00);
+		F c1 = c01 + fy * (c11 - c01);
+		result = (c0 + fz * (c1 - c0)) + .5f * result;
+	}
+}
+
+template<typename F, typename I>
+static inline __attribute__((always_inline)) void tiled_batch(
+	NoiseTiles const* tiles, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	const int width = sizeof(F) / sizeof(float);
+	for(int start = 0; start < n; start += width)
+	{
+		//The last block is padded with zeros
+		const int count = n - start < width ? n - start : width;
+		F xv = (F){}, yv = (F){}, zv = (F){}, result;
+		memcpy(&xv, x + start, count * sizeof(float));
+		memcpy(&yv, y + start, count * sizeof(float));
+		memcpy(&zv, z + start, count * sizeof(float));
+		tiled_lanes<F, I>(tiles, xv, yv, zv, octaves, result);
+		memcpy(out + start, &result, count * sizeof(float));
+	}
+}
+
+__attribute__((target("sse4.1")))
+static void simplexNoise3D_tiled_sse41(NoiseTiles const* tiles, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	tiled_batch<vfloat4, vint4>(tiles, x, y, z, out, n, octaves);
+}
+
+__attribute__((target("avx2")))
+static void simplexNoise3D_tiled_avx2(NoiseTiles const* tiles, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	tiled_batch<vfloat8, vint8>(tiles, x, y, z, out, n, octaves);
+}
+
+#endif
+
+static void simplexNoise3D_tiled_scalar(NoiseTiles const* tiles, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	for(int i = 0; i < n; i++)
+		out[i] = simplexNoise3D_tiled(tiles, x[i], y[i], z[i], octaves);
+}
+
+typedef void (*TiledBatchFunc)(NoiseTiles const*, const float*, const float*, const float*, float*, int, int64_t);
+
+static TiledBatchFunc select_tiled_batch()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return simplexNoise3D_tiled_avx2;
+	if(__builtin_cpu_supports("sse4.1"))
+		return simplexNoise3D_tiled_sse41;
+#endif
+	return simplexNoise3D_tiled_scalar;
+}
+
+void simplexNoise3D_tiled_batch(NoiseTiles const* tiles, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	if(!tiles->samples)
+	{
+		simplexNoise3D_batch(tiles->context, x, y, z, out, n, octaves);
+		return;
+	}
+	
+	static const TiledBatchFunc func = select_tiled_batch();
+	func(tiles, x, y, z, out, n, octaves);
+}
+
+/*
+ * The functions without a context use the default one.
+ */
+
+void setNoiseSeed(int64_t i)
+{
+	setNoiseSeed(defaultNoiseContext(), i);
+}
+
+void setNoiseHash(NoiseHash hash)
+{
+	setNoiseHash(defaultNoiseContext(), hash);
+}
+
+float simplexNoise2D(float xin, float yin, int64_t octaves)
+{
+	return simplexNoise2D(defaultNoiseContext(), xin, yin, octaves);
+}
+
+float simplexNoise3D(float xin, float yin, float zin, int64_t octaves)
+{
+	return simplexNoise3D(defaultNoiseContext(), xin, yin, zin, octaves);
+}
+
+float simplexNoise3D_grad(float xin, float yin, float zin, int64_t octaves, float* gradient)
+{
+	return simplexNoise3D_grad(defaultNoiseContext(), xin, yin, zin, octaves, gradient);
+}
+
+void simplexNoise3D_batch(const float* x, const float* y, const float* z, float* out, int n, int64_t octaves)
+{
+	simplexNoise3D_batch(defaultNoiseContext(), x, y, z, out, n, octaves);
+}
+
+void simplexNoise3D_bounds(
+	float xlo, float ylo, float zlo,
+	float xhi, float yhi, float zhi,
+	int64_t octaves, float* min, float* max)
+{
+	simplexNoise3D_bounds(defaultNoiseContext(), xlo, ylo, zlo, xhi, yhi, zhi, octaves, min, max);
+}
+
+int32_t pseudorand(int32_t a)
+{
+	return pseudorand(defaultNoiseContext(), a);
+}
+
+int64_t pseudorand_var(int64_t i, ...)
+{
+	va_list args;
+	va_start(args, i);
+	
+	int64_t retval = 0;
+	for(int64_t x = 0; x < i; x++)
+		retval = pseudorand(retval + va_arg(args, int64_t));
+	
+	va_end(args);
+	
+	return retval;
 }
@@ -3,13 +3,115 @@
 
 #include <stdint.h>
 
+//Hashes of the lattice points which pick the noise gradients.  The default
+//chains pseudorand over the coordinates, the table hash looks them up in a
+//permutation of 0..255 shuffled by the seed and is a few times cheaper.
+enum NoiseHash {
+	NOISE_HASH_PSEUDORAND = 0,
+	NOISE_HASH_TABLE = 1
+};
+
+//State of a noise function:  its seed, its hash and the hash tables built
+//from them.  The noise functions only read a context, so any number of
+//threads may share one, and differently seeded noise can be evaluated at the
+//same time from contexts of its own.  A context must not be modified while
+//it is in use.
+//
+//The table hash repeats every period lattice cells along each lattice axis
+//(a power of two up to 256), which makes the noise periodic:  it repeats
+//every 3 * period units along x, y and z.  Periods below 16 use only some
+//of the 12 gradients.
+struct NoiseContext {
+	NoiseContext(int64_t seed = 0, NoiseHash hash = NOISE_HASH_PSEUDORAND, int period = 256);
+
+	int64_t		seed;
+	NoiseHash	hash;
+	int			period;
+
+	//Permutation of 0..period-1 shuffled by the seed, repeated up to 512 entries
+	//so that sums of an entry and a lattice coordinate can index it, and its
+	//entries mod 12
+	uint8_t		perm[512];
+	uint8_t		perm_mod12[512];
+};
+
+//The context used by the functions below which do not take one
+NoiseContext* defaultNoiseContext();
+
+void setNoiseSeed(NoiseContext* ctx, int64_t seed);
+void setNoiseHash(NoiseContext* ctx, NoiseHash hash);
+
 void setNoiseSeed(int64_t);
+void setNoiseHash(NoiseHash hash);
 
 float simplexNoise1D(float xin, int64_t octaves);
 float simplexNoise2D(float xin, float yin, int64_t octaves);
+float simplexNoise2D(NoiseContext const* ctx, float xin, float yin, int64_t octaves);
 float simplexNoise3D(float xin, float yin, float zin, int64_t octaves);
+float simplexNoise3D(NoiseContext const* ctx, float xin, float yin, float zin, int64_t octaves);
+
+//simplexNoise3D, also writing its derivatives along x, y and z to gradient[0..2]
+float simplexNoise3D_grad(float xin, float yin, float zin, int64_t octaves, float* gradient);
+float simplexNoise3D_grad(NoiseContext const* ctx, float xin, float yin, float zin, int64_t octaves, float* gradient);
+
+//Writes simplexNoise3D(x[i], y[i], z[i], octaves) to out[i] for 0 <= i < n,
+//using SSE4.1 or AVX2 when the CPU has them.  Results are within 1e-5 of
+//the scalar function for |coordinate| * 2^(octaves-1) < 2^31.
+void simplexNoise3D_batch(const float* x, const float* y, const float* z, float* out, int n, int64_t octaves);
+void simplexNoise3D_batch(NoiseContext const* ctx, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves);
+
+//Default number of samples of NoiseTiles along each axis
+#define NOISE_TILE_RESOLUTION 128
+
+//Samples of one period of a periodic context (one using the table hash),
+//from which simplexNoise3D_tiled approximates its simplexNoise3D, for
+//previews and distant terrain.  The error grows with the square of the
+//sample spacing 3 * period / resolution:  period 8 and resolution 256 (64MB
+//of samples) are within .025 per octave.  The resolution is rounded up to a
+//power of two.  Tiles of a context with another hash hold no samples, and
+//sampling them evaluates the noise exactly.  The context must outlive the
+//tiles.
+struct NoiseTiles {
+	NoiseTiles(NoiseContext const* ctx, int resolution = NOISE_TILE_RESOLUTION);
+	~NoiseTiles();
+
+	NoiseContext const*	context;
+	int					resolution;
+	float				period, scale;
+
+	//Samples of the first octave at (i, j, k) / scale for i, j, k in
+	//[0, resolution), with i varying fastest
+	float*				samples;
+
+private:
+	NoiseTiles(NoiseTiles const&);
+	NoiseTiles& operator=(NoiseTiles const&);
+};
+
+//simplexNoise3D of the tiles' context, interpolated trilinearly from the
+//samples.  Differs from it by at most simplexNoise3D_tiled_error.
+float simplexNoise3D_tiled(NoiseTiles const* tiles, float xin, float yin, float zin, int64_t octaves);
+void simplexNoise3D_tiled_batch(NoiseTiles const* tiles, const float* x, const float* y, const float* z, float* out, int n, int64_t octaves);
+float simplexNoise3D_tiled_error(NoiseTiles const* tiles, int64_t octaves);
+
+//Range [min,max] of simplexNoise2D/3D over all inputs
+void simplexNoise2D_range(int64_t octaves, float* min, float* max);
+void simplexNoise3D_range(int64_t octaves, float* min, float* max);
+
+//Range [min,max] containing simplexNoise3D on the box [lo,hi]
+void simplexNoise3D_bounds(
+	float xlo, float ylo, float zlo,
+	float xhi, float yhi, float zhi,
+	int64_t octaves, float* min, float* max);
+void simplexNoise3D_bounds(
+	NoiseContext const* ctx,
+	float xlo, float ylo, float zlo,
+	float xhi, float yhi, float zhi,
+	int64_t octaves, float* min, float* max);
 
 int32_t pseudorand(int32_t a);
+int32_t pseudorand(NoiseContext const* ctx, int32_t a);
 int64_t pseudorand_var(int64_t i, ...);
+int64_t pseudorand_var(NoiseContext const* ctx, int64_t i, ...);
 
 #endif
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cmath>
+
 #include <Eigen/Core>
 #include "terrain.h"
 #include "noise.h"
@@ -8,18 +11,70 @@ using namespace Eigen;
 namespace App {
 
 float TerrainGenerator::operator()(Vector3f const& p) {
-	return (p[1]-128.0)+ 90*simplexNoise3D(0.01*p[0], 0.01*p[1], 0.01*p[2], 3);
+	if(tiles)
+		return (p[1]-128.0)+ 90*simplexNoise3D_tiled(tiles, 0.01*p[0], 0.01*p[1], 0.01*p[2], 3);
+	return (p[1]-128.0)+ 90*simplexNoise3D(noise, 0.01*p[0], 0.01*p[1], 0.01*p[2], 3);
+}
+
+void TerrainGenerator::operator()(
+	Vector3f const& origin,
+	Vector3f const& step,
+	int count,
+	float* out) {
+	
+	//Evaluate the noise in batches
+	const int batch = 64;
+	float x[batch], y[batch], z[batch], n_out[batch];
+	for(int start=0; start<count; start+=batch) {
+		const int n = std::min(count - start, batch);
+		for(int i=0; i<n; ++i) {
+			const Vector3f p = origin + (float)(start + i) * step;
+			x[i] = 0.01*p[0];
+			y[i] = 0.01*p[1];
+			z[i] = 0.01*p[2];
+		}
+		if(tiles)
+			simplexNoise3D_tiled_batch(tiles, x, y, z, n_out, n, 3);
+		else
+			simplexNoise3D_batch(noise, x, y, z, n_out, n, 3);
+		for(int i=0; i<n; ++i) {
+			const float p_y = origin[1] + (float)(start + i) * step[1];
+			out[start + i] = (p_y-128.0) + 90*n_out[i];
+		}
+	}
+}
+
+Vector2f TerrainGenerator::bounds(
+	Vector3f const& lo,
+	Vector3f const& hi) {
+	
+	float n_min, n_max;
+	simplexNoise3D_bounds(
+		noise,
+		0.01*lo[0], 0.01*lo[1], 0.01*lo[2],
+		0.01*hi[0], 0.01*hi[1], 0.01*hi[2],
+		3, &n_min, &n_max);
+	if(tiles) {
+		const float error = simplexNoise3D_tiled_error(tiles, 3);
+		n_min -= error;
+		n_max += error;
+	}
+	return Vector2f(
+		(lo[1]-128.0) + 90*n_min,
+		(hi[1]-128.0) + 90*n_max);
+}
+
+Vector3f TerrainGenerator::gradient(Vector3f const& p) {
+	float g[3];
+	simplexNoise3D_grad(noise, 0.01*p[0], 0.01*p[1], 0.01*p[2], 3, g);
+	return Vector3f(0.9*g[0], 1.0 + 0.9*g[1], 0.9*g[2]);
 }
 
 TerrainVertex TerrainAttribute::operator()(Vector3f const& p) {
 	TerrainVertex result;
 	result.position = p;
 	
-	float c0 = terrain(p);
-	result.normal = Vector3f(
-		c0 - terrain(p + Vector3f(0.001, 0, 0)),
-		c0 - terrain(p + Vector3f(0, 0.001, 0)),
-		c0 - terrain(p + Vector3f(0, 0, 0.001)));
+	result.normal = -terrain.gradient(p);
 	result.normal.normalize();
 	
 	result.color = result.normal;
@@ -27,5 +82,126 @@ TerrainVertex TerrainAttribute::operator()(Vector3f const& p) {
 	return result;	
 }
 
+TerrainVertex TerrainAttribute::operator()(
+	Vector3f const& p,
+	Vector3f const& gradient) {
+	
+	TerrainVertex result;
+	result.position = p;
+	result.normal = -gradient;
+	result.normal.normalize();
+	result.color = result.normal;
+	return result;
+}
+
+//Rounds x to the nearest integer in [lo,hi]
+static int quantize(float x, int lo, int hi) {
+	return std::max(lo, std::min(hi, (int)floor(x + 0.5f)));
+}
+
+CompactTerrainVertex compact_vertex(
+	TerrainVertex const& v,
+	Vector3f const& origin,
+	float extent) {
+	
+	CompactTerrainVertex result;
+	for(int i=0; i<3; ++i)
+		result.position[i] = quantize((v.position[i] - origin[i]) * (65536.f / extent), 0, 65535);
+	
+	//Project the normal onto the octahedron |x|+|y|+|z| = 1, and fold its
+	//lower half over the upper one
+	const float l1 = fabs(v.normal[0]) + fabs(v.normal[1]) + fabs(v.normal[2]);
+	float u = 1.f, w = 0.f;
+	if(l1 > 0.f) {
+		u = v.normal[0] / l1;
+		w = v.normal[1] / l1;
+		if(v.normal[2] < 0.f) {
+			const float fu = (1.f - fabs(w)) * (u < 0.f ? -1.f : 1.f);
+			const float fw = (1.f - fabs(u)) * (w < 0.f ? -1.f : 1.f);
+			u = fu;
+			w = fw;
+		}
+	}
+	result.normal[0] = quantize(u * 32767.f, -32767, 32767);
+	result.normal[1] = quantize(w * 32767.f, -32767, 32767);
+	
+	result.material = 0;
+	result.unused = 0;
+	return result;
+}
+
+TerrainVertex expand_vertex(
+	CompactTerrainVertex const& v,
+	Vector3f const& origin,
+	float extent) {
+	
+	TerrainVertex result;
+	for(int i=0; i<3; ++i)
+		result.position[i] = origin[i] + v.position[i] * (extent / 65536.f);
+	
+	const float u = v.normal[0] / 32767.f, w = v.normal[1] / 32767.f;
+	result.normal = Vector3f(u, w, 1.f - fabs(u) - fabs(w));
+	if(result.normal[2] < 0.f) {
+		result.normal[0] = (1.f - fabs(w)) * (u < 0.f ? -1.f : 1.f);
+		result.normal[1] = (1.f - fabs(u)) * (w < 0.f ? -1.f : 1.f);
+	}
+	result.normal.normalize();
+	
+	result.color = result.normal;
+	return result;
+}
+
+};
+
+namespace Mesh {
+
+const char* PlyVertexFormat<App::TerrainVertex>::header() {
+	return
+		"property float x\n"
+		"property float y\n"
+		"property float z\n"
+		"property float nx\n"
+		"property float ny\n"
+		"property float nz\n"
+		"property float red\n"
+		"property float green\n"
+		"property float blue\n";
+}
+
+void PlyVertexFormat<App::TerrainVertex>::ascii(FILE* fout, App::TerrainVertex const& v) {
+	fprintf(fout, "%f %f %f %f %f %f %f %f %f\n",
+		v.position[0], v.position[1], v.position[2],
+		v.normal[0], v.normal[1], v.normal[2],
+		v.color[0], v.color[1], v.color[2]);
+}
+
+void PlyVertexFormat<App::TerrainVertex>::binary(FILE* fout, App::TerrainVertex const& v) {
+	fwrite(v.position.data(), sizeof(float), 3, fout);
+	fwrite(v.normal.data(), sizeof(float), 3, fout);
+	fwrite(v.color.data(), sizeof(float), 3, fout);
+}
+
+const char* PlyVertexFormat<App::CompactTerrainVertex>::header() {
+	return
+		"property ushort x\n"
+		"property ushort y\n"
+		"property ushort z\n"
+		"property short octahedral_u\n"
+		"property short octahedral_v\n"
+		"property uchar material\n";
+}
+
+void PlyVertexFormat<App::CompactTerrainVertex>::ascii(FILE* fout, App::CompactTerrainVertex const& v) {
+	fprintf(fout, "%u %u %u %d %d %u\n",
+		v.position[0], v.position[1], v.position[2],
+		v.normal[0], v.normal[1],
+		v.material);
+}
+
+void PlyVertexFormat<App::CompactTerrainVertex>::binary(FILE* fout, App::CompactTerrainVertex const& v) {
+	fwrite(v.position, sizeof(uint16_t), 3, fout);
+	fwrite(v.normal, sizeof(int16_t), 2, fout);
+	fwrite(&v.material, 1, 1, fout);
+}
 
 };
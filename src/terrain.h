@@ -1,27 +1,125 @@
 #ifndef CHUNK_H
 #define CHUNK_H
 
+#include <stdint.h>
+#include <cstdio>
+
 #include <Eigen/Core>
 
+#include "mesh/serialize/ply.h"
+#include "noise.h"
+
 namespace App {
 
 struct TerrainVertex {
 	Eigen::Vector3f position, normal, color;
 };
 
+/**
+ * A TerrainVertex packed in 12 bytes instead of 36, for storing and exporting
+ * meshes.
+ *
+ * position is quantized to 16 bits per axis, in steps of extent / 65536 from
+ * origin, so the vertices must lie in [origin, origin + extent) (typically
+ * around the chunk they were contoured in) and the box has to be stored
+ * alongside them.  The error is extent / 131072 per axis.  normal is
+ * octahedral encoded to two 16 bit integers, within .0001 of the unit
+ * normal.  The generator colors vertices by their normal, which is material
+ * 0;  other materials are left to the renderer.
+ */
+struct CompactTerrainVertex {
+	uint16_t	position[3];
+	int16_t		normal[2];
+	uint8_t		material, unused;
+};
+
+CompactTerrainVertex compact_vertex(
+	TerrainVertex const& v,
+	Eigen::Vector3f const& origin,
+	float extent);
+
+TerrainVertex expand_vertex(
+	CompactTerrainVertex const& v,
+	Eigen::Vector3f const& origin,
+	float extent);
+
 struct TerrainGenerator {
+	//noise must outlive the generator
+	TerrainGenerator(NoiseContext const* noise_ = defaultNoiseContext()) :
+		noise(noise_),
+		tiles(NULL) {}
+	
+	//Preview terrain, which samples the noise from tiles (see NoiseTiles)
+	TerrainGenerator(NoiseTiles const* tiles_) :
+		noise(tiles_->context),
+		tiles(tiles_) {}
+	
 	float operator()(Eigen::Vector3f const& p);
+	
+	//Batched row evaluator, see mesh/algorithms/density.h
+	void operator()(
+		Eigen::Vector3f const& origin,
+		Eigen::Vector3f const& step,
+		int count,
+		float* out);
+
+	//Range of the density on the box [lo,hi], see mesh/algorithms/density.h
+	Eigen::Vector2f bounds(
+		Eigen::Vector3f const& lo,
+		Eigen::Vector3f const& hi);
+	
+	//Analytic gradient of the density, ignoring the error of tiles
+	Eigen::Vector3f gradient(Eigen::Vector3f const& p);
+	
+private:
+	NoiseContext const*	noise;
+	NoiseTiles const*	tiles;
+};
+
+//Gradient lambda for dual contouring, see mesh/algorithms/dual_contour.h
+struct TerrainGradient {
+	TerrainGradient(TerrainGenerator& t) : terrain(t) {}
+	Eigen::Vector3f operator()(Eigen::Vector3f const& p) {
+		return terrain.gradient(p);
+	}
+	
+private:
+	TerrainGenerator& terrain;
 };
 
 struct TerrainAttribute {
 	TerrainAttribute(TerrainGenerator& t) : terrain(t) {}
 	TerrainVertex operator()(Eigen::Vector3f const& p);
 	
+	//Uses the gradient estimated by the contouring code, see mesh/algorithms/density.h
+	TerrainVertex operator()(
+		Eigen::Vector3f const& p,
+		Eigen::Vector3f const& gradient);
+	
 private:
 	TerrainGenerator& terrain;
 };
 
 };
 
+namespace Mesh {
+
+//Writes the position, normal and color
+template<> struct PlyVertexFormat<App::TerrainVertex> {
+	static const char* header();
+	static void ascii(FILE* fout, App::TerrainVertex const& v);
+	static void binary(FILE* fout, App::TerrainVertex const& v);
+};
+
+//Writes the packed fields as they are, the box of the positions should go in
+//the comment of the file
+template<> struct PlyVertexFormat<App::CompactTerrainVertex> {
+	static const char* header();
+	static void ascii(FILE* fout, App::CompactTerrainVertex const& v);
+	static void binary(FILE* fout, App::CompactTerrainVertex const& v);
+};
+
+};
+
 #endif
 
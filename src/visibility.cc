@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Core>
+
+#include "chunk_manager.h"
+#include "visibility.h"
+
+using namespace std;
+using namespace Eigen;
+
+namespace App {
+
+bool ChunkCoordLess::operator()(Vector3i const& a, Vector3i const& b) const {
+	for(int i=0; i<3; ++i) {
+		if(a[i] != b[i])
+			return a[i] < b[i];
+	}
+	return false;
+}
+
+Frustum::Frustum(Matrix4f const& clip) {
+	//Gribb and Hartmann:  the planes are the sums and differences of the last
+	//row of the matrix with the other ones
+	for(int i=0; i<3; ++i) {
+		planes[2*i]   = (clip.row(3) + clip.row(i)).transpose();
+		planes[2*i+1] = (clip.row(3) - clip.row(i)).transpose();
+	}
+	for(int i=0; i<6; ++i)
+		planes[i] /= planes[i].head<3>().norm();
+}
+
+FrustumTest Frustum::test(Vector3f const& lo, Vector3f const& hi) const {
+	FrustumTest result = FRUSTUM_INSIDE;
+	for(int i=0; i<6; ++i) {
+		//Corners of the box furthest along and against the plane normal
+		Vector3f p, n;
+		for(int j=0; j<3; ++j) {
+			p[j] = planes[i][j] >= 0.f ? hi[j] : lo[j];
+			n[j] = planes[i][j] >= 0.f ? lo[j] : hi[j];
+		}
+		if(planes[i].head<3>().dot(p) + planes[i][3] < 0.f)
+			return FRUSTUM_OUTSIDE;
+		if(planes[i].head<3>().dot(n) + planes[i][3] < 0.f)
+			result = FRUSTUM_INTERSECT;
+	}
+	return result;
+}
+
+//Coordinates of the parent of a node
+static Vector3i parent_coord(Vector3i const& c) {
+	Vector3i result;
+	for(int i=0; i<3; ++i)
+		result[i] = c[i] >= 0 ? c[i] / 2 : (c[i] - 1) / 2;
+	return result;
+}
+
+//Distance from p to the box [lo,hi]
+static float box_distance(Vector3f const& p, Vector3f const& lo, Vector3f const& hi) {
+	return (p.cwiseMax(lo).cwiseMin(hi) - p).norm();
+}
+
+static bool nearer(VisibleChunk const& a, VisibleChunk const& b) {
+	return a.distance < b.distance;
+}
+
+ChunkVisibility::ChunkVisibility(float lod_distance_, int max_lod_) :
+	lod_distance(lod_distance_),
+	max_lod(max_lod_) {}
+
+void ChunkVisibility::insert(TerrainChunk const* chunk) {
+	remove(chunk->coord);
+
+	Node leaf;
+	leaf.lo = chunk->lo;
+	leaf.hi = chunk->hi;
+	leaf.chunk = chunk;
+	leaf.children = 0;
+	levels[0][chunk->coord] = leaf;
+
+	//Grow the ancestors, creating the missing ones
+	Vector3i coord = chunk->coord;
+	bool added = true;
+	for(int l=1; l<VISIBILITY_LEVELS; ++l) {
+		coord = parent_coord(coord);
+		Level::iterator it = levels[l].find(coord);
+		if(it == levels[l].end()) {
+			Node node;
+			node.lo = chunk->lo;
+			node.hi = chunk->hi;
+			node.chunk = NULL;
+			node.children = 1;
+			levels[l][coord] = node;
+			continue;
+		}
+		it->second.lo = it->second.lo.cwiseMin(chunk->lo);
+		it->second.hi = it->second.hi.cwiseMax(chunk->hi);
+		if(added)
+			++it->second.children;
+		added = false;
+	}
+}
+
+void ChunkVisibility::remove(Vector3i const& coord) {
+	Level::iterator it = levels[0].find(coord);
+	if(it == levels[0].end())
+		return;
+	levels[0].erase(it);
+
+	Vector3i c = coord;
+	for(int l=1; l<VISIBILITY_LEVELS; ++l) {
+		c = parent_coord(c);
+		refit(l, c);
+	}
+}
+
+void ChunkVisibility::refit(int level, Vector3i const& coord) {
+	Level::iterator it = levels[level].find(coord);
+	if(it == levels[level].end())
+		return;
+
+	Node& node = it->second;
+	node.children = 0;
+	for(int i=0; i<8; ++i) {
+		const Vector3i child = 2 * coord + Vector3i(i & 1, (i >> 1) & 1, i >> 2);
+		Level::const_iterator c = levels[level-1].find(child);
+		if(c == levels[level-1].end())
+			continue;
+		if(node.children == 0) {
+			node.lo = c->second.lo;
+			node.hi = c->second.hi;
+		}
+		else {
+			node.lo = node.lo.cwiseMin(c->second.lo);
+			node.hi = node.hi.cwiseMax(c->second.hi);
+		}
+		++node.children;
+	}
+	if(node.children == 0)
+		levels[level].erase(it);
+}
+
+void ChunkVisibility::select(
+	Frustum const& frustum,
+	Vector3f const& eye,
+	float max_distance,
+	vector<VisibleChunk>& out) const {
+
+	out.clear();
+	Level const& roots = levels[VISIBILITY_LEVELS-1];
+	for(Level::const_iterator it = roots.begin(); it != roots.end(); ++it)
+		visit(VISIBILITY_LEVELS-1, it->first, it->second, false, frustum, eye, max_distance, out);
+	sort(out.begin(), out.end(), nearer);
+}
+
+void ChunkVisibility::visit(
+	int level,
+	Vector3i const& coord,
+	Node const& node,
+	bool inside,
+	Frustum const& frustum,
+	Vector3f const& eye,
+	float max_distance,
+	vector<VisibleChunk>& out) const {
+
+	const float distance = box_distance(eye, node.lo, node.hi);
+	if(distance > max_distance)
+		return;
+	if(!inside) {
+		const FrustumTest t = frustum.test(node.lo, node.hi);
+		if(t == FRUSTUM_OUTSIDE)
+			return;
+		inside = t == FRUSTUM_INSIDE;
+	}
+
+	if(level == 0) {
+		VisibleChunk v;
+		v.chunk = node.chunk;
+		v.distance = distance;
+		v.lod = 0;
+		for(float d = lod_distance; v.lod < max_lod && distance >= d; d *= 2.f)
+			++v.lod;
+		out.push_back(v);
+		return;
+	}
+
+	Level const& children = levels[level-1];
+	for(int i=0; i<8; ++i) {
+		const Vector3i child = 2 * coord + Vector3i(i & 1, (i >> 1) & 1, i >> 2);
+		Level::const_iterator it = children.find(child);
+		if(it != children.end())
+			visit(level-1, child, it->second, inside, frustum, eye, max_distance, out);
+	}
+}
+
+};
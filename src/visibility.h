@@ -0,0 +1,121 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <map>
+#include <vector>
+
+#include <Eigen/Core>
+
+//Number of levels of the ChunkVisibility hierarchy;  a node of the top level
+//covers 2^(levels-1) chunks along each axis
+#define VISIBILITY_LEVELS	6
+
+//Default coarsest level of detail returned by ChunkVisibility
+#define VISIBILITY_MAX_LOD	3
+
+namespace App {
+
+struct TerrainChunk;
+
+///Lexicographic order on chunk coordinates
+struct ChunkCoordLess {
+	bool operator()(Eigen::Vector3i const& a, Eigen::Vector3i const& b) const;
+};
+
+///Result of testing a box against a Frustum
+enum FrustumTest {
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECT,
+	FRUSTUM_INSIDE
+};
+
+/**
+ * The six planes of a view frustum, extracted from a projection * modelview
+ * matrix (OpenGL conventions, column vectors).  Planes are stored as (n, d)
+ * with n pointing inside, so p is inside a plane when n.p + d >= 0.
+ */
+struct Frustum {
+	Frustum(Eigen::Matrix4f const& clip);
+
+	///Tests the box [lo,hi] conservatively:  boxes near the corners of the frustum may intersect it without being outside any plane
+	FrustumTest test(Eigen::Vector3f const& lo, Eigen::Vector3f const& hi) const;
+
+	Eigen::Vector4f planes[6];
+};
+
+///A chunk selected by ChunkVisibility
+struct VisibleChunk {
+	TerrainChunk const*	chunk;
+	float				distance;
+	int					lod;
+};
+
+/**
+ * A hierarchy of bounding boxes over the chunks of a ChunkManager, which
+ * selects the chunks a camera sees without touching the others.
+ *
+ * Level 0 holds the bounding box of the vertices of each chunk, and a node
+ * of level k + 1 the union of the boxes of its (up to 8) children, the nodes
+ * of level k whose coordinates halved and rounded down are its coordinates.
+ * Selecting skips the subtrees outside the frustum or further than
+ * max_distance, and stops testing the planes below nodes inside the frustum,
+ * so its cost depends on the number of visible chunks rather than the number
+ * of chunks.
+ *
+ * The level of detail of a chunk is 0 within lod_distance of the eye, and
+ * increases by one each time the distance doubles, up to max_lod.  Needs no
+ * GL context.
+ */
+struct ChunkVisibility {
+	ChunkVisibility(float lod_distance = 64.f, int max_lod = VISIBILITY_MAX_LOD);
+
+	///Adds a chunk, using its coord and bounding box, or replaces the chunk with the same coord
+	void insert(TerrainChunk const* chunk);
+
+	///Removes the chunk at coord, if any
+	void remove(Eigen::Vector3i const& coord);
+
+	/**
+	 * Writes the chunks which intersect frustum and are within max_distance
+	 * of eye to out, nearest first.
+	 */
+	void select(
+		Frustum const& frustum,
+		Eigen::Vector3f const& eye,
+		float max_distance,
+		std::vector<VisibleChunk>& out) const;
+
+	int size() const {
+		return (int)levels[0].size();
+	}
+
+	float	lod_distance;
+	int		max_lod;
+
+private:
+	struct Node {
+		Eigen::Vector3f		lo, hi;
+		TerrainChunk const*	chunk;
+		int					children;
+	};
+
+	typedef std::map<Eigen::Vector3i, Node, ChunkCoordLess>	Level;
+
+	void refit(int level, Eigen::Vector3i const& coord);
+
+	void visit(
+		int level,
+		Eigen::Vector3i const& coord,
+		Node const& node,
+		bool inside,
+		Frustum const& frustum,
+		Eigen::Vector3f const& eye,
+		float max_distance,
+		std::vector<VisibleChunk>& out) const;
+
+	Level	levels[VISIBILITY_LEVELS];
+};
+
+};
+
+#endif